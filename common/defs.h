@@ -27,18 +27,179 @@
 #define DIGILIVOLO_PRODUCT_STRING L"DigiLivolo"
 
 #define REPORT_ID 0x4c
+#define REPORT_ID_MULTI 0x4d // Feature report with several commands, see dlusb_multi_packet_t
+#define REPORT_ID_STATUS 0x4e // Feature report with the device queues state, see dlusb_status_packet_t
+#define REPORT_ID_DATA 0x4f // Feature report with a block of data, see dlusb_data_packet_t
+#define REPORT_ID_STATS 0x50 // Feature report with the device counters, see dlusb_stats_packet_t
 
 #define CMD_SWITCH 0x01 // IN,OUT send Livolo keycode command or send ACK to the host
 #define CMD_SWITCH_OLD 0x02 // IN,OUT send Livolo keycode command or send ACK to the host, but use original Livolo lib method
+#define CMD_SWITCH_MULTI 0x03 // IN,OUT send several Livolo keycodes from REPORT_ID_MULTI report, one ACK when all are sent
+#define CMD_STATUS 0x04 // IN, device status in REPORT_ID_STATUS report
+#define CMD_SCENE 0x05 // IN,OUT play scene from the device EEPROM, btn_id - scene ID. ACK when all codes are sent
+#define CMD_SCENE_WRITE 0x06 // IN,OUT write block of the scene table in REPORT_ID_DATA report, ACK when written
+#define CMD_TIMING 0x07 // OUT, RF timing profile (dl_timing_t) in REPORT_ID_DATA report read by the host
+#define CMD_TIMING_WRITE 0x08 // IN,OUT set RF timing profile from REPORT_ID_DATA report, ACK when stored in EEPROM
+#define CMD_STATS 0x09 // OUT, device counters in REPORT_ID_STATS report
+#define CMD_TIMES 0x0A // OUT, device timings of the command (dlusb_times_packet_t), sent after its ACK if asked with DL_FLAG_TIMES
 #define CMD_ERR_UNKNOWN 0xFF // OUT ERROR unknown CMD code
 #define CMD_RDY 0x10 // OUT, device ready command
 #define CMD_FAIL_BIT (uint8_t)(1 << 7) // Not used
 
+// Values of the dlusb_packet_t.status field in the device replies
+#define DL_STATUS_OK 0x00 // Command processed
+#define DL_STATUS_ERR_UNKNOWN 0x01 // Unknown CMD code, reply cmd_id is set to CMD_ERR_UNKNOWN
+#define DL_STATUS_ERR_SCENE 0x02 // No scene with such ID
+#define DL_STATUS_ERR_BUSY 0x03 // Scene are being played or its table are being written
+#define DL_STATUS_ERR_RANGE 0x04 // Data block doesn't fit in the scene table or timing value out of range
+
+/* Flags in the dlusb_packet_t.status field of the host commands.
+ * DL_FLAG_INTR: deliver replies & events via the interrupt IN endpoint instead of
+ * keeping them for the GET_REPORT (feature report) requests. Applies to the replies
+ * pending in the device queue as well, until command without this flag arrives.
+ * DL_FLAG_TIMES: send CMD_TIMES report after the ACK of CMD_SWITCH or CMD_SWITCH_OLD command. */
+#define DL_FLAG_INTR 0x80
+#define DL_FLAG_TIMES 0x10
+
+/* First firmware version (USB bcdDevice) which echoes seq & status fields.
+ * Older versions leave them zeroed in the replies. */
+#define DL_FW_VERSION_SEQ 0x0300
+// First firmware version which supports DL_FLAG_INTR & has INPUT report in the descriptor
+#define DL_FW_VERSION_INTR 0x0300
+// First firmware version which accepts REPORT_ID_MULTI reports
+#define DL_FW_VERSION_MULTI 0x0300
+// First firmware version which returns REPORT_ID_STATUS report
+#define DL_FW_VERSION_STATUS 0x0300
+// First firmware version which supports scenes (CMD_SCENE, CMD_SCENE_WRITE)
+#define DL_FW_VERSION_SCENE 0x0300
+// First firmware version with RF timing profile (CMD_TIMING, CMD_TIMING_WRITE)
+#define DL_FW_VERSION_TIMING 0x0300
+// First firmware version which takes frame repeats from the commands (repeats field)
+#define DL_FW_VERSION_REPEATS 0x0300
+// First firmware version which returns REPORT_ID_STATS report
+#define DL_FW_VERSION_STATS 0x0300
+// First firmware version which sends CMD_TIMES reports (DL_FLAG_TIMES)
+#define DL_FW_VERSION_TIMES 0x0300
+
+// Max commands in one REPORT_ID_MULTI report
+#define DL_MULTI_MAX 8
+
+// Flags in the dlusb_status_packet_t.flags field
+#define DL_STATE_RF_ON_AIR 0x01 // Button code are being transmitted
+#define DL_STATE_SCENE 0x02 // Scene are being played
+
+// Bytes in one REPORT_ID_DATA block
+#define DL_DATA_SIZE 32
+
+/* Scene table in the device EEPROM. Scenes are stored one after another, each as dl_scene_t
+ * followed by its count of dl_tuple_t. Table ends with DL_SCENE_END ID or at DL_SCENES_SIZE. */
+#define DL_SCENES_SIZE 448
+#define DL_SCENE_END 0xFF
+#define DL_SCENE_NAME_LEN 8
+
+// Flags in the dl_tuple_t.flags field
+#define DL_TUPLE_FLAG_OLD 0x01 // Use original Livolo lib method, as CMD_SWITCH_OLD
+
 typedef struct dlusb_packet {
   uint8_t report_id;
   uint8_t cmd_id;
   uint16_t remote_id;
   uint8_t btn_id;
+  uint8_t seq; // Command sequence number set by the host, echoed back in the reply. 0 - untagged.
+  uint8_t status; // DL_STATUS_* code in the device replies, DL_FLAG_* in commands from the host
+  uint8_t repeats; // Frame repeats after the first one for CMD_SWITCH. 0 - RF timing profile default.
 } dlusb_packet_t;
 
+/* Device timings of a command, sent as REPORT_ID report after its ACK. Same size as dlusb_packet_t,
+ * seq are at the same place, so it's matched the same way. Device clock are millis(), command is
+ * received when firmware takes it from its USB queue. */
+typedef struct dlusb_times_packet {
+  uint8_t report_id; // REPORT_ID
+  uint8_t cmd_id; // CMD_TIMES
+  uint16_t queue_ms; // From the command received to its transmit start
+  uint8_t reserved;
+  uint8_t seq; // Sequence number of the command
+  uint16_t air_ms; // From the transmit start to the end, ACK are sent right after it
+} dlusb_times_packet_t;
+
+// One command of the REPORT_ID_MULTI report
+typedef struct dl_tuple {
+  uint16_t remote_id;
+  uint8_t btn_id;
+  uint8_t flags; // DL_TUPLE_FLAG_*
+} dl_tuple_t;
+
+/* Several commands in one feature report. Device queues all of them or none & replies once
+ * with CMD_SWITCH_MULTI report (dlusb_packet_t with zero remote_id & btn_id) when the last one
+ * has been sent. Header are padded to keep tuples aligned the same way on AVR & the host. */
+typedef struct dlusb_multi_packet {
+  uint8_t report_id; // REPORT_ID_MULTI
+  uint8_t cmd_id; // CMD_SWITCH_MULTI
+  uint8_t seq; // Sequence number for the reply, as in dlusb_packet_t
+  uint8_t status; // DL_FLAG_* as in dlusb_packet_t
+  uint8_t count; // Tuples used, 1 to DL_MULTI_MAX
+  uint8_t repeats; // Frame repeats for all the tuples, as in dlusb_packet_t
+  dl_tuple_t tuples[DL_MULTI_MAX];
+} dlusb_multi_packet_t;
+
+/* Device state, returned on GET_REPORT with REPORT_ID_STATUS. Host can send up to rx_free
+ * commands (counting every command of the multi command report) without them being rejected. */
+typedef struct dlusb_status_packet {
+  uint8_t report_id; // REPORT_ID_STATUS
+  uint8_t cmd_id; // CMD_STATUS
+  uint8_t rx_pending; // Commands received & waiting in the device queue
+  uint8_t rx_free; // Commands device queue can take now
+  uint8_t reply_free; // Replies device queue can take before they're dropped
+  uint8_t rf_queued; // Button codes in the transmit queue, including the one on air
+  uint8_t rf_repeats_left; // Repeats left to send of the button code on air
+  uint8_t flags; // DL_STATE_*
+} dlusb_status_packet_t;
+
+/* Device counters since power up, returned on GET_REPORT with REPORT_ID_STATS. Counters wrap
+ * around, host should graph differences between the reads. Header are padded to keep counters
+ * aligned the same way on AVR & the host. */
+typedef struct dlusb_stats_packet {
+  uint8_t report_id; // REPORT_ID_STATS
+  uint8_t cmd_id; // CMD_STATS
+  uint16_t usb_resets; // USB bus resets, including the one on the device connect
+  uint32_t commands; // Commands received, counting every command of the multi command report
+  uint32_t rx_overflows; // Reports rejected as the device queue was full or the data buffer busy
+  uint32_t unknown; // Commands with unknown CMD ID
+  uint32_t bursts; // Button codes transmitted
+  uint32_t frames; // Frames transmitted, first ones & repeats
+  uint32_t airtime_ms; // Time transmitter was on air
+  uint32_t loop_max_us; // Longest main loop iteration, i.e. how long USB could wait for usbPoll()
+} dlusb_stats_packet_t;
+
+/* Block of data written by the host, e.g. part of the scene table for CMD_SCENE_WRITE.
+ * Same size as dlusb_multi_packet_t, they share one buffer on the device. */
+typedef struct dlusb_data_packet {
+  uint8_t report_id; // REPORT_ID_DATA
+  uint8_t cmd_id; // CMD_SCENE_WRITE
+  uint8_t seq; // Sequence number for the reply, as in dlusb_packet_t
+  uint8_t status; // DL_FLAG_* as in dlusb_packet_t
+  uint16_t offset; // Offset of the block
+  uint8_t data[DL_DATA_SIZE];
+} dlusb_data_packet_t;
+
+// Scene header in the scene table
+typedef struct dl_scene {
+  uint8_t id; // 0 to 254, DL_SCENE_END marks the table end
+  uint8_t count; // Count of dl_tuple_t following the header
+  uint8_t gap; // Pause between button codes, 10 ms units. Device keeps at least its default pause.
+  uint8_t reserved;
+  char name[DL_SCENE_NAME_LEN]; // Zero padded, not terminated if it takes all the bytes
+} dl_scene_t;
+
+/* RF timing profile, as read & written in REPORT_ID_DATA data. Device converts pulse widths
+ * to its Timer ticks (~2 us), so values read back are rounded to them. */
+typedef struct dl_timing {
+  uint16_t start_us; // Start pulse
+  uint16_t bit_us; // Pulse of 1 bit
+  uint16_t half_us; // Pulse of 0 bit half, 0 bit are two of them
+  uint16_t gap_ms; // Pause between button codes
+  uint8_t repeats; // Frame repeats after the first one. 0 restores defaults on write.
+  uint8_t reserved;
+} dl_timing_t;
+
 #endif // __defs_h__
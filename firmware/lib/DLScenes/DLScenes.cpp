@@ -0,0 +1,115 @@
+/* Part of the DigiLivolo firmware.
+ * https://github.com/N-Storm/DigiLivolo/ 
+ * Copyright (c) 2024 GitHub user N-Storm.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include "DLScenes.h"
+
+/// @brief Looks up the scene in the EEPROM table & starts playing it.
+/// @param id[in] scene ID
+/// @return true if found, false if there's no such scene
+bool DLScenes::play(uint8_t id) {
+  uint16_t pos = DL_EEPROM_SCENES;
+  dl_scene_t scene;
+
+  // Scene records go one after another, walk through the headers only
+  while (pos + sizeof(dl_scene_t) <= DL_EEPROM_SCENES + DL_SCENES_SIZE) {
+    eeprom_read_block(&scene, (const void*)pos, offsetof(dl_scene_t, name));
+    if (scene.id == DL_SCENE_END)
+      break;
+
+    pos += sizeof(dl_scene_t);
+    if (scene.id == id) {
+      // Truncated scene plays what fits in the table
+      uint16_t fit = (DL_EEPROM_SCENES + DL_SCENES_SIZE - pos) / sizeof(dl_tuple_t);
+      left = (scene.count < fit) ? scene.count : fit;
+      addr = pos;
+      gap = scene.gap;
+      in_flight = false;
+      last_sent = millis() - (unsigned long)gap * 10;
+      active = true;
+      return true;
+    }
+    pos += scene.count * sizeof(dl_tuple_t);
+  }
+
+  return false;
+}
+
+/// @brief Returns next button code of the scene when it's time to send it, i.e. previous one
+///        has been sent & the scene gap passed. Call sent() when it's been transmitted.
+/// @param tuple[out] button code to send
+/// @return true if tuple are filled
+bool DLScenes::next(dl_tuple_t* tuple) {
+  if (!active || in_flight || left == 0 || millis() - last_sent < (unsigned long)gap * 10)
+    return false;
+
+  eeprom_read_block(tuple, (const void*)addr, sizeof(dl_tuple_t));
+  addr += sizeof(dl_tuple_t);
+  left--;
+  in_flight = true;
+  return true;
+}
+
+/// @brief Marks button code returned by next() as sent.
+void DLScenes::sent() {
+  in_flight = false;
+  last_sent = millis();
+}
+
+/// @brief Returns true once, when all button codes of the playing scene has been sent.
+bool DLScenes::finished() {
+  if (!active || in_flight || left != 0)
+    return false;
+
+  active = false;
+  return true;
+}
+
+/// @brief Starts writing a DL_DATA_SIZE bytes block of the scene table to EEPROM.
+///        Data must stay valid until task() reports the write completed.
+/// @param offset[in] offset in the scene table
+/// @param data[in] DL_DATA_SIZE bytes to write
+/// @return true if started, false if block doesn't fit in the table
+bool DLScenes::write(uint16_t offset, const uint8_t* data) {
+  if (offset > DL_SCENES_SIZE - DL_DATA_SIZE)
+    return false;
+
+  w_data = data;
+  w_addr = DL_EEPROM_SCENES + offset;
+  w_left = DL_DATA_SIZE;
+  return true;
+}
+
+/// @brief Writes next byte of the block when EEPROM are ready. One byte write takes
+///        about 3.4 ms, so it's done one byte per call to keep USB serviced.
+/// @return true when the last byte of the block has been written
+bool DLScenes::task() {
+  if (w_left == 0 || !eeprom_is_ready())
+    return false;
+
+  // Only changed bytes are written, saves EEPROM wear on the repeated uploads
+  eeprom_update_byte((uint8_t*)w_addr, *w_data);
+  w_addr++;
+  w_data++;
+  w_left--;
+
+  return (w_left == 0);
+}
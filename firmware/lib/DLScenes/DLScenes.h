@@ -0,0 +1,63 @@
+/* Part of the DigiLivolo firmware.
+ * https://github.com/N-Storm/DigiLivolo/ 
+ * Copyright (c) 2024 GitHub user N-Storm.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __DLScenes_h__
+#define __DLScenes_h__
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "defs.h"
+
+/* EEPROM address of the scene table (DL_SCENES_SIZE bytes, up to the EEPROM end).
+ * Bytes below are reserved for the device settings, i.e. OSCCAL_EEPROM_ADDR. */
+#define DL_EEPROM_SCENES 0x40
+
+/// @brief Plays scenes stored in EEPROM & writes the scene table uploaded by the host.
+///        Nothing here blocks, both are advanced by the calls from the main loop.
+class DLScenes
+{
+public:
+  bool play(uint8_t id);
+  bool next(dl_tuple_t* tuple);
+  void sent();
+  bool finished();
+
+  bool write(uint16_t offset, const uint8_t* data);
+  bool task();
+
+  /// @brief Returns true if a scene are being played.
+  bool playing() { return active; }
+  /// @brief Returns true if a block of the scene table are being written.
+  bool writing() { return w_left != 0; }
+private:
+  bool active = false;
+  bool in_flight = false; // Button code from the scene are being sent
+  uint16_t addr = 0; // EEPROM address of the next tuple
+  uint8_t left = 0; // Tuples left to send
+  uint8_t gap = 0; // Pause between button codes, 10 ms units
+  unsigned long last_sent = 0; // millis() when last button code has been sent
+
+  const uint8_t* w_data = NULL; // Next byte to write
+  uint16_t w_addr = 0; // EEPROM address to write it to
+  uint8_t w_left = 0; // Bytes left to write
+};
+
+#endif // __DLScenes_h__
@@ -18,9 +18,18 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <avr/eeprom.h>
 #include "DLTransmitter.h"
 
-volatile dl_buffer_u dl_buf = { 0 };
+/* Edge schedule of the frame being aired: OCR value for the period following each
+ * edge, starting from the start pulse end. Last entry are the next start pulse. */
+uint8_t dl_sched[DL_SCHED_SIZE];
+uint8_t dl_sched_last; // Index of the last dl_sched entry
+volatile uint8_t dl_sched_idx = 0; // Next dl_sched entry to load
+// Repeats of the frame left to air after the current one
+volatile uint8_t dl_repeats_left = 0;
+// Set while the Timer ISR airs the burst
+volatile bool dl_airing = false;
 
 uint8_t txPin_g = 0;
 
@@ -37,6 +46,91 @@ DLTransmitter::DLTransmitter(uint8_t pin) : Livolo(pin)
     pinMode(pin, OUTPUT);
     txPin = pin;
   #endif
+
+  defaultTiming();
+}
+
+/// @brief Sets RF timing profile to the compile time defaults.
+void DLTransmitter::defaultTiming() {
+  #ifdef DL_TIMER
+    t_start = OCR_START;
+    t_full = OCR_FULLBIT;
+    t_half = OCR_HALFBIT;
+  #endif
+  t_repeats = DLTRANSMIT_REPEATS;
+  t_gap_ms = DLTRANSMIT_GAP_MS;
+}
+
+/// @brief Sets RF timing profile used by the next bursts. Doesn't store it, see saveTiming().
+/// @param timing[in] profile, repeats == 0 restores the defaults
+/// @return true if set, false if a bit pulse doesn't fit in 2 - DL_TICKS_MAX Timer ticks, start
+///         pulse is under 2 ticks, gap is over 10 s or Timer isn't available. Longer start pulse
+///         is cut to DL_TICKS_MAX (~496 us).
+bool DLTransmitter::setTiming(const dl_timing_t* timing) {
+  #ifdef DL_TIMER
+    if (timing->repeats == 0) {
+      defaultTiming();
+      return true;
+    }
+
+    uint32_t start = DL_US_TO_TICKS(timing->start_us);
+    uint32_t full = DL_US_TO_TICKS(timing->bit_us);
+    uint32_t half = DL_US_TO_TICKS(timing->half_us);
+    if (start > DL_TICKS_MAX)
+      start = DL_TICKS_MAX;
+    if (start < 2 || full < 2 || full > DL_TICKS_MAX || half < 2 || half > DL_TICKS_MAX || timing->gap_ms > 10000)
+      return false;
+
+    // OCR values, CTC period is OCR + 1
+    t_start = start - 1;
+    t_full = full - 1;
+    t_half = half - 1;
+    t_repeats = timing->repeats;
+    t_gap_ms = timing->gap_ms;
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+/// @brief Returns RF timing profile in effect, pulse widths are rounded to the Timer ticks.
+/// @param timing[out] profile
+void DLTransmitter::getTiming(dl_timing_t* timing) {
+  memset(timing, 0, sizeof(*timing));
+  #ifdef DL_TIMER
+    timing->start_us = DL_TICKS_TO_US(t_start + 1);
+    timing->bit_us = DL_TICKS_TO_US(t_full + 1);
+    timing->half_us = DL_TICKS_TO_US(t_half + 1);
+  #endif
+  timing->repeats = t_repeats;
+  timing->gap_ms = t_gap_ms;
+}
+
+/// @brief Loads RF timing profile stored in EEPROM, keeps the defaults if there's none
+///        (erased EEPROM) or it's invalid.
+void DLTransmitter::loadTiming() {
+  dl_timing_t timing;
+
+  eeprom_read_block(&timing, (const void*)DL_EEPROM_TIMING, sizeof(timing));
+  if (!setTiming(&timing))
+    defaultTiming();
+}
+
+/// @brief Stores RF timing profile in EEPROM for loadTiming(). Blocks until written, about
+///        3.4 ms per changed byte.
+/// @param timing[in] profile accepted by setTiming()
+/// @param idleCallback_ptr[in](optional) Pointer to a function(void) which will be called while
+///        waiting for EEPROM. Should be really small to return very soon.
+void DLTransmitter::saveTiming(const dl_timing_t* timing, void (*idleCallback_ptr)(void)) {
+  const uint8_t* data = (const uint8_t*)timing;
+
+  for (uint8_t i = 0; i < sizeof(dl_timing_t); i++) {
+    while (!eeprom_is_ready()) {
+      if (idleCallback_ptr != NULL)
+        idleCallback_ptr();
+    }
+    eeprom_update_byte((uint8_t*)DL_EEPROM_TIMING + i, data[i]);
+  }
 }
 
 /// @brief Sends button pressed packet, blocks until complete.
@@ -44,96 +138,238 @@ DLTransmitter::DLTransmitter(uint8_t pin) : Livolo(pin)
 /// @param keycode[in] Key code
 /// @param use_timer[in] Set to true if you want to use hardware Timer for better accuracy. Will fallback to software method if timer will be unavailable.
 /// @param idleCallback_ptr[in](optional) Pointer to a function(void) which will be called on idling. Should be really small to return very soon.
-void DLTransmitter::sendButton(uint16_t remoteID, uint8_t keycode, bool use_timer, void (*idleCallback_ptr)(void)) {
-  // Use new Timer function if available & not used right now.
+/// @param repeats[in](optional) Frame repeats after the first one, 0 - as set by the RF timing profile.
+///        Original function always sends its own count.
+void DLTransmitter::sendButton(uint16_t remoteID, uint8_t keycode, bool use_timer, void (*idleCallback_ptr)(void), uint8_t repeats) {
+  // Use new Timer function if available. Wait for the queued codes to be sent first.
   #ifdef DL_TIMER
-    if (use_timer == true && txPin_g == 0) {
-      txPin_g = txPin;
-
-      // Clear transmit buffer struct
-      memset((void *)&dl_buf, 0, sizeof(dl_buf));
-
-      /* Sequence begins with remoteID (16 bits), followed by a keycode (7 bits).
-       * I.e. one code sequence are aired as "(remoteID << 7) + (keycode & 0x7F)".
-       * We always set remaining MSB in keycode to 1, it's used to find an end of sequence when we're shifting bits on transmit and aren't transmitted. */
-      keycode |= (1 << 7);
-
-      // Prepare data bits in transmit order (reversed as they are right shifted during transmit), it will be copied later to volatile struct dl_buf.
-      uint8_t dl_buf_origin[3];
-      dl_buf_origin[2] = __builtin_avr_insert_bits(0x70123456, keycode, 0);
-      dl_buf_origin[1] = __builtin_avr_insert_bits(0x01234567, (uint8_t)(remoteID & 0xFF), 0);
-      dl_buf_origin[0] = __builtin_avr_insert_bits(0x01234567, (uint8_t)(remoteID >> 8), 0);
-
-      // Save timer registers if not on a native core
-      #ifndef DL_NATIVE_CORE
-        uint8_t tccr1_saved, gtccr_saved, tifr_saved, ocr1a_saved, ocr1c_saved;
-        tccr1_saved = TCCR1;
-        gtccr_saved = GTCCR;
-        tifr_saved = TIFR;
-        ocr1a_saved = OCR1A;
-        ocr1c_saved = OCR1C;
-      #endif
-
-      // Transmit loop. Packet with one button press are transmitted 128 times, as the original remote does.
-      for (uint8_t z = 0; z <= DLTRANSMIT_REPEATS; z++) {
-        memcpy((void *)dl_buf.bytes, dl_buf_origin, 3);
-
-        #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN) // ATTiny 25/45/85 has only one IO PORT - B.
-          PORTB |= 1 << DL_STATIC_PIN;
-        #elif defined(__AVR_ATtinyX5__)
-          PORTB |= 1 << txPin;
-        #else
-          digitalWrite(txPin, HIGH);
-        #endif
-
-        timer1_start();
-        // while (dl_buf.buf > 1);
-        // TODO: Make non-blocking function
-        while (dl_buf.buf != 0)
-          if (idleCallback_ptr != NULL)
-            idleCallback_ptr();
-
-        timer1_stop();
+    if (use_timer == true) {
+      while (full()) {
+        task();
+        if (idleCallback_ptr != NULL)
+          idleCallback_ptr();
       }
 
-      #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN)
-        PORTB &= ~(1 << DL_STATIC_PIN);
-      #elif defined(__AVR_ATtinyX5__)
-        PORTB &= ~(1 << txPin);
-      #else
-        digitalWrite(txPin, LOW);
-      #endif
-
-      timer1_stop();
-      #if DL_TIMER == DL_TIMER_PLL
-        PLLCSR &= ~(1 << PCKE);
-      #endif
-      #ifndef DL_NATIVE_CORE
-      #endif
-
-      OCR1C = 0xFF;
-
-      // Reset interrupt flags
-      TIFR = (1 << OCF1A | 1 << OCF1B | 1 << TOV1);
-
-      // Restore timer-related registers content
-      #if not defined(DL_NATIVE_CORE) && DL_TIMER == 1
-        TCCR1 = tccr1_saved;
-        GTCCR = gtccr_saved;
-        TIFR = tifr_saved;
-        OCR1A = ocr1a_saved;
-        OCR1C = ocr1c_saved;
-      #endif
-
-      txPin_g = 0;
+      enqueue(remoteID, keycode, DLTRANSMIT_TAG_NONE, repeats);
+      while (busy()) {
+        task();
+        if (idleCallback_ptr != NULL)
+          idleCallback_ptr();
+      }
     }
     else // Use original function
   #endif
+    {
+      burst_since = millis();
       Livolo::sendButton(remoteID, keycode);
+      bursts++;
+      frames += DL_LIVOLO_FRAMES;
+      airtime_ms += millis() - burst_since;
+    }
+}
+
+/// @brief Queues button pressed packet for transmit with the hardware Timer & returns
+///        immediately. Transmit are driven by the Timer ISRs & task() calls.
+/// @param remoteID[in] Remote ID
+/// @param keycode[in] Key code
+/// @param tag[in](optional) Value passed to the done callback when this code has been sent,
+///        DLTRANSMIT_TAG_NONE (default) to skip the callback
+/// @param repeats[in](optional) Frame repeats after the first one, 0 - as set by the RF timing profile
+/// @return true if queued, false if the queue is full or Timer isn't available
+bool DLTransmitter::enqueue(uint16_t remoteID, uint8_t keycode, uint8_t tag, uint8_t repeats) {
+  #ifdef DL_TIMER
+    if (full())
+      return false;
+
+    dl_frame_t* frame = &queue[(q_head + q_count) % DLTRANSMIT_QUEUE_SIZE];
+    frame->remote_id = remoteID;
+    frame->keycode = keycode;
+    frame->tag = tag;
+    frame->repeats = repeats;
+
+    q_count++;
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+/// @brief Sets a function to be called from task() when a queued button code has been sent.
+/// @param doneCallback_ptr[in] Pointer to a function(uint8_t tag), gets tag value passed to enqueue()
+void DLTransmitter::onDone(void (*doneCallback_ptr)(uint8_t tag)) {
+  doneCallback = doneCallback_ptr;
+}
+
+/// @brief Advances transmit: starts next repeat or queued code, calls done callback.
+///        Should be called often from the main loop, doesn't block.
+void DLTransmitter::task() {
+  #ifdef DL_TIMER
+    if (on_air) {
+      // Timer ISR airs all repeats, then stops the Timer & clears dl_airing
+      if (dl_airing)
+        return;
+
+      uint8_t tag = queue[q_head].tag;
+      q_head = (q_head + 1) % DLTRANSMIT_QUEUE_SIZE;
+      q_count--;
+      on_air = false;
+      idle_since = millis();
+      bursts++;
+      frames += burst_repeats + 1;
+      airtime_ms += idle_since - burst_since;
+
+      burst_end();
+
+      if (doneCallback != NULL && tag != DLTRANSMIT_TAG_NONE)
+        doneCallback(tag);
+    }
+
+    if (q_count > 0 && millis() - idle_since >= t_gap_ms) {
+      burst_begin();
+      burst_since = millis();
+      on_air = true;
+      frame_start();
+    }
+  #endif
+}
+
+/// @brief Sets measured CPU clock, pulse widths of the next bursts are corrected for its error.
+///        Timer clock (prescaled or PLL) follows the CPU RC oscillator, so OCR values are scaled
+///        by actual / nominal clock ratio.
+/// @param actual[in] measured clock, i.e. CPU cycles per USB frame from DLUSB.clockFrameCycles()
+/// @param nominal[in] same at exactly F_CPU. Ignored if either is 0.
+void DLTransmitter::setClock(uint16_t actual, uint16_t nominal) {
+  if (actual == 0 || nominal == 0)
+    return;
+
+  clock_actual = actual;
+  clock_nominal = nominal;
+}
+
+/// @brief Returns how many repeats of the button code on air were sent.
+uint8_t DLTransmitter::progress() {
+  #ifdef DL_TIMER
+    if (on_air)
+      return burst_repeats - dl_repeats_left;
+  #endif
+  return 0;
+}
+
+/// @brief Returns how many repeats of the button code on air are left to send.
+uint8_t DLTransmitter::repeatsLeft() {
+  #ifdef DL_TIMER
+    if (on_air)
+      return dl_repeats_left;
+  #endif
+  return 0;
+}
+
+/// @brief Fills transmitter counters: bursts, frames & airtime.
+/// @param stats[in,out] stats report
+void DLTransmitter::getStats(dlusb_stats_packet_t* stats) {
+  stats->bursts = bursts;
+  stats->frames = frames;
+  stats->airtime_ms = airtime_ms;
 }
 
 #ifdef DL_TIMER
 
+/// @brief Scales nominal OCR value to the measured clock, rounding & limiting to 8 bits.
+///        Period (OCR + 1 ticks) is scaled, not the OCR value.
+uint8_t DLTransmitter::ocr_scale(uint16_t ocr) {
+  uint32_t scaled = ((uint32_t)(ocr + 1) * clock_actual + clock_nominal / 2) / clock_nominal;
+  return (scaled > DL_TICKS_MAX) ? 255 : (scaled < 2) ? 1 : (uint8_t)(scaled - 1);
+}
+
+/// @brief Takes Timer 1 & sets transmit pin, saving timer registers if not on a native core.
+///        OCR values are scaled to the measured clock once per burst.
+void DLTransmitter::burst_begin() {
+  txPin_g = txPin;
+
+  ocr_full = ocr_scale(t_full);
+  ocr_half = ocr_scale(t_half);
+  ocr_start = ocr_scale(t_start);
+
+  #ifndef DL_NATIVE_CORE
+    tccr1_saved = TCCR1;
+    gtccr_saved = GTCCR;
+    tifr_saved = TIFR;
+    ocr1a_saved = OCR1A;
+    ocr1c_saved = OCR1C;
+  #endif
+}
+
+/// @brief Releases Timer 1 after all repeats of the button code has been sent
+void DLTransmitter::burst_end() {
+  #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN)
+    PORTB &= ~(1 << DL_STATIC_PIN);
+  #elif defined(__AVR_ATtinyX5__)
+    PORTB &= ~(1 << txPin);
+  #else
+    digitalWrite(txPin, LOW);
+  #endif
+
+  timer1_stop();
+  #if DL_TIMER == DL_TIMER_PLL
+    PLLCSR &= ~(1 << PCKE);
+  #endif
+
+  OCR1C = 0xFF;
+
+  // Reset interrupt flags
+  TIFR = (1 << OCF1A | 1 << OCF1B | 1 << TOV1);
+
+  // Restore timer-related registers content
+  #if not defined(DL_NATIVE_CORE) && DL_TIMER == 1
+    TCCR1 = tccr1_saved;
+    GTCCR = gtccr_saved;
+    TIFR = tifr_saved;
+    OCR1A = ocr1a_saved;
+    OCR1C = ocr1c_saved;
+  #endif
+
+  txPin_g = 0;
+}
+
+/// @brief Builds edge schedule for the frame at the queue head & starts airing it.
+///        Timer ISR restarts it on the frame end, so the whole burst goes with one Timer start.
+void DLTransmitter::frame_start() {
+  /* Sequence begins with remoteID (16 bits), followed by a keycode (7 bits), MSB first.
+   * I.e. one code sequence are aired as "(remoteID << 7) + (keycode & 0x7F)".
+   * Every bit ends with an edge, 0 has one more edge in the middle. */
+  uint32_t bits = ((uint32_t)queue[q_head].remote_id << 7) | (queue[q_head].keycode & 0x7F);
+  uint8_t n = 0;
+
+  for (uint32_t mask = 1UL << 22; mask != 0; mask >>= 1) {
+    if (bits & mask)
+      dl_sched[n++] = ocr_full;
+    else {
+      dl_sched[n++] = ocr_half;
+      dl_sched[n++] = ocr_half;
+    }
+  }
+  // Period after the last bit edge are the start pulse of the next repeat
+  dl_sched[n] = ocr_start;
+  dl_sched_last = n;
+  dl_sched_idx = 0;
+
+  /* Packet with one button press are transmitted 128 times by default, as the original remote does.
+   * Commands can ask for less to free the transmitter sooner, or more for the distant receivers. */
+  burst_repeats = queue[q_head].repeats ? queue[q_head].repeats : t_repeats;
+  dl_repeats_left = burst_repeats;
+  dl_airing = true;
+
+  #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN) // ATTiny 25/45/85 has only one IO PORT - B.
+    PORTB |= 1 << DL_STATIC_PIN;
+  #elif defined(__AVR_ATtinyX5__)
+    PORTB |= 1 << txPin;
+  #else
+    digitalWrite(txPin, HIGH);
+  #endif
+
+  timer1_start();
+}
+
 /// @brief Initializes and starts Timer 1
 void DLTransmitter::timer1_start() {
   cli();
@@ -157,9 +393,9 @@ void DLTransmitter::timer1_start() {
   // CTC
   TCCR1 |= (1 << CTC1);
 
-  OCR1C = OCR_START; // 500 uS
+  OCR1C = ocr_start; // 500 uS
   // interrupt COMPA
-  OCR1A = OCR_START; // 500 uS
+  OCR1A = ocr_start; // 500 uS
   // Output Compare Match A Interrupt Enable
   TIMSK |= (1 << OCIE1A);
   // Prescaler 128, start timer
@@ -186,23 +422,6 @@ void DLTransmitter::timer1_stop() {
   sei();
 }
 
-/// @brief Sets interrupt timings by updating output compare registers
-/// @param ocr[in] OCR value (used values are defined in OCR_ macros)
-/// @param ocr_aux[in](optional) OCR value for additional transition (for sending 0 in DL protocol)
-inline void timer1_update(uint8_t ocr, uint8_t ocr_aux = 0) {
-  OCR1A = ocr;
-  OCR1C = ocr;
-  if (ocr_aux > 0) {
-    OCR1B = ocr_aux;
-    TIFR = 1 << OCF1B;
-    TIMSK |= (1 << OCIE1B);
-  }
-  else {
-    TIMSK &= ~(1 << OCIE1B);
-    // OCR1B = 0xFF;
-  }
-}
-
 /// @brief Inverts TX pin output
 void inline switch_txPin() {
   #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN)
@@ -220,31 +439,45 @@ void inline switch_txPin() {
   #endif
 }
 
+/// @brief Sets TX pin output high (start pulse)
+void inline set_txPin_high() {
+  #if defined(__AVR_ATtinyX5__) && defined (DL_STATIC_PIN)
+    PORTB |= 1 << DL_STATIC_PIN;
+  #elif defined(__AVR_ATtinyX5__)
+    PORTB |= 1 << txPin_g;
+  #else
+    state_buf = true;
+    digitalWrite(txPin_g, HIGH);
+  #endif
+}
+
+/* Airs edges from dl_sched. Fixed cost for all the edges except the frame end:
+ * flip the pin & load the period till the next edge. */
 ISR(TIMER1_COMPA_vect, ISR_NOBLOCK) {
   switch_txPin();
 
-  // TODO: no need to update OCR1A, OCR1C with a FULLBIT value
-  if ((dl_buf.bytes[0] & 0x01) == 0) {
-    timer1_update(OCR_FULLBIT, OCR_HALFBIT);
+  uint8_t i = dl_sched_idx;
+  OCR1A = dl_sched[i];
+  OCR1C = dl_sched[i];
+
+  if (i != dl_sched_last) {
+    dl_sched_idx = i + 1;
+    return;
+  }
+
+  /* This edge completes the frame. Next repeat starts right away with a start
+   * pulse (loaded above), Timer keeps running so there's no gap. */
+  dl_sched_idx = 0;
+  if (dl_repeats_left != 0) {
+    dl_repeats_left--;
+    set_txPin_high();
   }
   else {
-    timer1_update(OCR_FULLBIT);
+    // Burst complete, stop the Timer. task() finishes it.
+    TCCR1 &= ~(1 << CS10 | 1 << CS11 | 1 << CS12 | 1 << CS13);
+    TIMSK &= ~(1 << OCIE1A);
+    dl_airing = false;
   }
-
-  dl_buf.buf >>= 1;
-}
-
-/* This interrupt are used only to flip txPin. If we have DL_STATIC_PIN set,
- * then it's only 1 SBI instruction, so no need for an ISR prologue, etc. */
-#if defined(__AVR_ATtinyX5__) && defined(DL_STATIC_PIN)
-ISR(TIMER1_COMPB_vect, ISR_NAKED) {
-#else
-ISR(TIMER1_COMPB_vect, ISR_NOBLOCK) {
-#endif
-  switch_txPin();
-#if defined(__AVR_ATtinyX5__) && defined(DL_STATIC_PIN)
-  asm("reti");
-#endif
 }
 
 #endif // DL_TIMER
@@ -25,27 +25,31 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "Livolo.h"
+#include "defs.h"
 
-// How many times packet are repeated on transmit for one button code
+// Default of how many times packet are repeated on transmit for one button code
 #define DLTRANSMIT_REPEATS 128
 
+// How many button codes can be queued for transmit, including the one on air
+#define DLTRANSMIT_QUEUE_SIZE 2
+
+// Default pause between two queued button codes, ms
+#define DLTRANSMIT_GAP_MS 100
+
+// Tag of the codes queued without the done callback call
+#define DLTRANSMIT_TAG_NONE 0xFF
+
+// Frames sent by the original Livolo lib method, for the counters
+#define DL_LIVOLO_FRAMES 181
+
+// EEPROM address of the RF timing profile (dl_timing_t), after OSCCAL_EEPROM_ADDR
+#define DL_EEPROM_TIMING 0x01
+
 /* Uncomment line below to make transmit pin set at compile time ("hardcoded").
  * Results in smaller interrupt routines -> more USB stability & RF accuracy.
  * If set, pin setting from the constructor call will be ignored. */
 #define DL_STATIC_PIN PIN_B5
 
-class DLTransmitter : public Livolo
-{
-public:
-  DLTransmitter(uint8_t pin);
-  void sendButton(uint16_t remoteID, uint8_t keycode, bool use_timer, void (*idleCallback_ptr)(void) = NULL);
-  using Livolo::sendButton;
-private:
-  uint8_t txPin;
-  void timer1_start();
-  void timer1_stop();
-};
-
 #define DL_TIMER_PLL 11
 
 #if defined(__AVR_ATtinyX5__) && defined(TIMER_TO_USE_FOR_MILLIS)
@@ -96,21 +100,93 @@ private:
   #define OCR_HALFBIT (OCR_FULLBIT)/2
 #endif
 
-/// @brief Union for a packet buffer for accessing individual bytes as array.
-typedef union {
-// avr-gcc ver >= 4.7 has a special 24 bit type __uint24, so we use it if availabled, and fallback to standard uint32_t if not.
-#if defined(__AVR__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
-  __uint24 buf;
-  uint8_t bytes[3];
-#else
-  uint32_t buf;
-  uint8_t bytes[4];
+#ifdef DL_TIMER
+  /* Conversion between us & Timer 1 ticks, same as the OCR_* values are calculated with.
+   * In CTC mode the period is OCR + 1 ticks, up to DL_TICKS_MAX. */
+  #if DL_TIMER == DL_TIMER_PLL
+    #define DL_TICK_HZ (F_CPU * 4 / 128) // PLL clock (4 x F_CPU), prescaler 128
+  #else
+    #define DL_TICK_HZ (F_CPU / DL_TIMER_PRESCALER)
+  #endif
+  #define DL_US_TO_TICKS(us) (((uint32_t)(us) * (DL_TICK_HZ / 100) + 5000) / 10000)
+  #define DL_TICKS_TO_US(t) (((uint32_t)(t) * 1000000UL + DL_TICK_HZ / 2) / DL_TICK_HZ)
+  #define DL_TICKS_MAX 256
 #endif
-} dl_buffer_u;
 
-inline void timer1_update(uint8_t ocr, uint8_t ocr_aux);
+// Max edges in one frame: start pulse end & 23 data bits, two edges each for 0
+#define DL_SCHED_SIZE (1 + 23 * 2)
+
+/// @brief One queued button code.
+typedef struct {
+  uint16_t remote_id;
+  uint8_t keycode;
+  uint8_t tag; // Caller supplied value, passed to the done callback
+  uint8_t repeats; // Frame repeats after the first one, 0 - profile default
+} dl_frame_t;
+
+class DLTransmitter : public Livolo
+{
+public:
+  DLTransmitter(uint8_t pin);
+  void sendButton(uint16_t remoteID, uint8_t keycode, bool use_timer, void (*idleCallback_ptr)(void) = NULL, uint8_t repeats = 0);
+  using Livolo::sendButton;
 
-// Declare builtin function as extern here to avoid linter errors.
-extern uint8_t __builtin_avr_insert_bits (uint32_t map, uint8_t bits, uint8_t val);
+  bool enqueue(uint16_t remoteID, uint8_t keycode, uint8_t tag = DLTRANSMIT_TAG_NONE, uint8_t repeats = 0);
+  void onDone(void (*doneCallback_ptr)(uint8_t tag));
+  void task();
+
+  /// @brief Returns true if there are button codes on air or queued.
+  bool busy() { return q_count != 0; }
+  /// @brief Returns true if transmit queue can't accept more button codes.
+  bool full() { return q_count >= DLTRANSMIT_QUEUE_SIZE; }
+  /// @brief Returns number of button codes queued, including the one on air.
+  uint8_t queued() { return q_count; }
+  /// @brief Returns true if a button code are being transmitted.
+  bool onAir() { return on_air; }
+  /// @brief Returns millis() when the last (or current) button code transmit has been started.
+  unsigned long burstStart() { return burst_since; }
+  uint8_t progress();
+  uint8_t repeatsLeft();
+  void getStats(dlusb_stats_packet_t* stats);
+  void setClock(uint16_t actual, uint16_t nominal);
+
+  bool setTiming(const dl_timing_t* timing);
+  void getTiming(dl_timing_t* timing);
+  void loadTiming();
+  void saveTiming(const dl_timing_t* timing, void (*idleCallback_ptr)(void) = NULL);
+  /// @brief Returns default frame repeats per button code after the first frame.
+  uint8_t repeats() { return t_repeats; }
+  /// @brief Returns pause between button codes, ms.
+  uint16_t gap() { return t_gap_ms; }
+private:
+  uint8_t txPin;
+  dl_frame_t queue[DLTRANSMIT_QUEUE_SIZE];
+  uint8_t q_head = 0; // Index of the frame on air (or next to be sent)
+  uint8_t q_count = 0;
+  bool on_air = false; // Frame at q_head are being transmitted
+  uint8_t burst_repeats = 0; // Repeats of the button code on air
+  unsigned long idle_since = 0; // millis() when last frame has been completed
+  unsigned long burst_since = 0; // millis() when the burst on air (or the last one) has been started
+  // Counters since power up
+  uint32_t bursts = 0, frames = 0, airtime_ms = 0;
+  void (*doneCallback)(uint8_t tag) = NULL;
+  // Measured & nominal CPU clock in any units, OCR values are scaled by their ratio
+  uint16_t clock_actual = 1, clock_nominal = 1;
+  // RF timing profile: OCR values at exactly F_CPU, repeats & gap
+  uint8_t t_start, t_full, t_half, t_repeats;
+  uint16_t t_gap_ms;
+  // OCR values for the burst on air, scaled to the measured clock
+  uint8_t ocr_half, ocr_full, ocr_start;
+  void defaultTiming();
+  uint8_t ocr_scale(uint16_t ocr);
+  #if defined(DL_TIMER) && !defined(DL_NATIVE_CORE)
+    uint8_t tccr1_saved, gtccr_saved, tifr_saved, ocr1a_saved, ocr1c_saved;
+  #endif
+  void frame_start();
+  void burst_begin();
+  void burst_end();
+  void timer1_start();
+  void timer1_stop();
+};
 
 #endif // __DLTRansmitter_h__
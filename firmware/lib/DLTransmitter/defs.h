@@ -0,0 +1 @@
+../../../common/defs.h
\ No newline at end of file
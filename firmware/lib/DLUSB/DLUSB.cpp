@@ -27,36 +27,107 @@
 #include <avr/pgmspace.h>   // required by usbdrv.h
 #include "usbdrv.h"
 #include "oddebug.h"        // This is also an example for using debug macros
+#include <stddef.h>         // for offsetof()
 
 #include "defs.h"
 #include "DLUSB.h"
 
-/* Ring buffer implementation nicked from HardwareSerial.cpp
- * TODO: Don't nick it. :) */
-ring_buffer rx_buffer = { { 0, 0, 0, 0 }, 0, 0 };
-ring_buffer tx_buffer = { { 0, 0, 0, 0 }, 0, 0 };
+// Zero initialized, i.e. empty
+dlusb_rx_ring_t rx_buffer;
+dlusb_tx_ring_t tx_buffer;
 
-/// @brief Stores packet in the ring buffer.
-/// @param[in] packet stored packet struct
-/// @param[out] buffer pointer to a buffer struct
-/// @return true if success, false if buffer is full
-inline bool store_packet(dlusb_packet_t* packet, ring_buffer* buffer)
-{
-  uint8_t newhead = (buffer->head + 1) % RING_BUFFER_SIZE;
-
-  /* if we should be storing the received data into the location
-   * just before the tail (meaning that the head would advance to the
-   * current location of the tail), we're about to overflow the buffer
-   * and so we don't write to the buffer or advance the head. */
-  if (newhead != buffer->tail && newhead <= RING_BUFFER_SIZE) {
-    memcpy(&buffer->buffer[buffer->head], packet, sizeof(dlusb_packet_t));
-    buffer->head = newhead;
-    return true;
+// Host asked to deliver replies via interrupt IN endpoint (DL_FLAG_INTR set in the last command)
+static bool intr_events = false;
+
+// Fills application part of the status report, set with DLUSB.onStatus()
+static void (*status_callback)(dlusb_status_packet_t* status) = NULL;
+// Fills data report read by the host, set with DLUSB.onDataRead()
+static void (*data_callback)(dlusb_data_packet_t* data) = NULL;
+// Fills application part of the stats report, set with DLUSB.onStats()
+static void (*stats_callback)(dlusb_stats_packet_t* stats) = NULL;
+
+/* Counters of the USB side. Same struct are returned to the host, so it's the report buffer as well
+ * and the application part are filled on each read. */
+static dlusb_stats_packet_t stats;
+unsigned usbResetCount = 0; // Incremented by USB_RESET_HOOK in osccal.h
+
+/* Interrupt IN endpoint state for the clock tracking. While the window is open and there are no
+ * replies, endpoint are armed with a zero length report, so each host poll takes something.
+ * Host HID drivers drop zero length reports. */
+static bool intr_armed = false; // Report set with usbSetInterrupt(), not taken yet
+static bool intr_zlp = false; // It's the zero length one
+static unsigned clock_resets = 0; // usbResetCount the tracking state belongs to
+static bool clock_paused = false; // Window completed, waiting for DLUSB_CLOCK_PAUSE_MS
+static bool clock_changed = false; // New clock for clockChanged()
+static unsigned long clock_done_ms; // millis() when the last window completed
+static unsigned long refresh_us; // micros() of the last refresh() in the window
+static unsigned long poll_us; // micros() of the last timed poll
+static bool poll_valid = false; // poll_us can start the next gap
+static unsigned long window_us; // Sum of the measured gaps, micros()
+static uint16_t window_frames; // Host frames in them
+static uint16_t clock_cycles = 0; // CPU cycles per frame by the last window, 0 if none since the reset
+
+/* REPORT_ID_MULTI or REPORT_ID_DATA report being received. V-USB passes SET_REPORT data to
+ * usbFunctionWrite() in chunks of up to 8 bytes, so it's reassembled here before processing.
+ * Data report stays in the buffer until loop() is done with it. */
+static union {
+  dlusb_multi_packet_t multi;
+  dlusb_data_packet_t data;
+} long_buf;
+static uint8_t long_len = 0; // Bytes received
+static uint8_t long_remaining = 0; // Bytes left to receive, 0 if single command report are expected
+static volatile bool data_pending = false; // long_buf holds data report for loop()
+
+/// @brief Queues all commands from the multi command report to rx_buffer, or none of them
+///        if it's malformed or there's not enough room.
+/// @param[in] multi reassembled report
+/// @param[in] len report bytes received
+/// @return true if queued
+static bool queue_multi(const dlusb_multi_packet_t* multi, uint8_t len) {
+  if (multi->report_id != REPORT_ID_MULTI || multi->cmd_id != CMD_SWITCH_MULTI || multi->count == 0 || \
+      multi->count > DL_MULTI_MAX || len < offsetof(dlusb_multi_packet_t, tuples) + multi->count * sizeof(dl_tuple_t))
+    return false;
+
+  // rx_buffer are consumed by loop() only, so free space can't shrink while we fill it
+  if (DLUSB_RX_QUEUE_SIZE - rx_buffer.count() < multi->count) {
+    stats.rx_overflows++;
+    return false;
+  }
+
+  intr_events = (multi->status & DL_FLAG_INTR) != 0;
+
+  dlusb_packet_t packet;
+  packet.report_id = REPORT_ID;
+  packet.seq = multi->seq;
+  packet.repeats = multi->repeats;
+  for (uint8_t i = 0; i < multi->count; i++) {
+    const dl_tuple_t* tuple = &multi->tuples[i];
+    packet.cmd_id = (tuple->flags & DL_TUPLE_FLAG_OLD) ? CMD_SWITCH_OLD : CMD_SWITCH;
+    packet.remote_id = tuple->remote_id;
+    packet.btn_id = tuple->btn_id;
+    packet.status = (i + 1 == multi->count) ? DLUSB_FLAG_MULTI_LAST : DLUSB_FLAG_MULTI;
+    rx_buffer.put(&packet);
   }
-  return false;
+
+  stats.commands += multi->count;
+  return true;
+}
+
+/// @brief Passes data report to loop(), which keeps long_buf until DLUSB.dataDone().
+/// @param[in] data reassembled report
+/// @param[in] len report bytes received
+/// @return true if accepted
+static bool queue_data(const dlusb_data_packet_t* data, uint8_t len) {
+  if (data->report_id != REPORT_ID_DATA || len < sizeof(dlusb_data_packet_t))
+    return false;
+
+  intr_events = (data->status & DL_FLAG_INTR) != 0;
+  data_pending = true;
+  stats.commands++;
+  return true;
 }
 
-DLUSBDevice::DLUSBDevice(ring_buffer* rx_buffer, ring_buffer* tx_buffer) {
+DLUSBDevice::DLUSBDevice(dlusb_rx_ring_t* rx_buffer, dlusb_tx_ring_t* tx_buffer) {
   _rx_buffer = rx_buffer;
   _tx_buffer = tx_buffer;
 }
@@ -65,22 +136,137 @@ DLUSBDevice::DLUSBDevice(ring_buffer* rx_buffer, ring_buffer* tx_buffer) {
 void DLUSBDevice::begin() {
   cli();
 
+  // Run at the calibrated clock right away, USB reset refines it
+  loadOscillator();
+
   usbInit();
 
+  /* Fake USB disconnect, so the host re-enumerates device after the reset. Hub latches
+   * the disconnect, so it only needs to be well above TDDIS (2.5 us). */
   usbDeviceDisconnect();
-  uchar   i;
-  i = 0;
-  while (--i) { // fake USB disconnect for > 250 ms
-    _delay_ms(10);
-  }
+  _delay_ms(DLUSB_DISCONNECT_MS);
   usbDeviceConnect();
 
   sei();
 }
 
-/// @brief Calls usbPoll() to process low-level USB stuff
+/// @brief Returns true while the clock tracking window is open.
+static bool clock_tracking() {
+  if (clock_paused && millis() - clock_done_ms >= DLUSB_CLOCK_PAUSE_MS)
+    clock_paused = false;
+
+  return !clock_paused;
+}
+
+/// @brief Adds the gap since the previous host poll of the interrupt IN endpoint to the window.
+/// @param now[in] micros() when the poll has been seen by refresh()
+static void clock_poll(unsigned long now) {
+  unsigned long gap = now - poll_us;
+
+  // Poll time is only known to the refresh() interval, main loop might've been blocked
+  if (now - refresh_us > DLUSB_CLOCK_JITTER_US) {
+    poll_valid = false;
+    return;
+  }
+
+  if (poll_valid && gap <= DLUSB_CLOCK_GAP_MAX_US) {
+    uint32_t cycles = gap * clockCyclesPerMicrosecond();
+    uint16_t frames = (cycles + DLUSB_FRAME_CYCLES / 2) / DLUSB_FRAME_CYCLES;
+    int32_t off = (int32_t)(cycles - (uint32_t)frames * DLUSB_FRAME_CYCLES);
+
+    // Far from the frame boundary it's a late or spurious poll, not counted
+    if (frames != 0 && off < DLUSB_FRAME_CYCLES / 4 && off > -(DLUSB_FRAME_CYCLES / 4)) {
+      window_us += gap;
+      window_frames += frames;
+    }
+
+    if (window_frames >= DLUSB_CLOCK_WINDOW_MS) {
+      clock_cycles = window_us * clockCyclesPerMicrosecond() / window_frames;
+      clock_changed = true;
+      clock_paused = true;
+      clock_done_ms = millis();
+      window_us = 0;
+      window_frames = 0;
+      poll_valid = false;
+      return;
+    }
+  }
+
+  poll_us = now;
+  poll_valid = true;
+}
+
+/// @brief Calls usbPoll() to process low-level USB stuff. Also sends next packet
+///        from tx_buffer via interrupt IN endpoint if host requested so, timing the
+///        host polls for the clock tracking meanwhile.
 void DLUSBDevice::refresh() {
+  DL_PROFILE_MARK(DL_PROFILE_USBPOLL);
   usbPoll();
+
+  // OSCCAL has been changed by the calibration, window starts over
+  if (usbResetCount != clock_resets) {
+    clock_resets = usbResetCount;
+    clock_cycles = 0;
+    clock_changed = true;
+    clock_paused = false;
+    window_us = 0;
+    window_frames = 0;
+    poll_valid = false;
+  }
+
+  if (!intr_events)
+    return;
+
+  bool tracking = clock_tracking();
+  unsigned long now = tracking ? micros() : 0;
+  // usbSetInterrupt() copies the data, so packet can be on stack
+  dlusb_packet_t packet;
+
+  if (usbInterruptIsReady()) {
+    // Host has taken the armed report on its poll
+    if (intr_armed && tracking)
+      clock_poll(now);
+
+    intr_armed = intr_zlp = false;
+    if (tx_buffer.get(&packet)) {
+      usbSetInterrupt((uchar*)&packet, sizeof(dlusb_packet_t));
+      intr_armed = true;
+    }
+    else if (tracking) {
+      usbSetInterrupt((uchar*)&packet, 0);
+      intr_armed = intr_zlp = true;
+    }
+  }
+  else if (intr_zlp && tx_buffer.get(&packet)) {
+    // Reply replaces the zero length report, so it doesn't wait for one more poll
+    usbSetInterrupt((uchar*)&packet, sizeof(dlusb_packet_t));
+    intr_zlp = false;
+    poll_valid = false;
+  }
+
+  if (tracking)
+    refresh_us = now;
+}
+
+/// @brief Returns CPU cycles per USB frame, measured against the host polls by the last
+///        tracking window or by the OSCCAL calibration on the last USB reset until then.
+/// @return cycles per frame (DLUSB_FRAME_CYCLES at exactly F_CPU) or 0 if not measured
+uint16_t DLUSBDevice::clockFrameCycles() {
+  if (clock_cycles != 0)
+    return clock_cycles;
+
+  // Calibration measures in usbMeasureFrameLength() loops, OSCCAL_TARGET at exactly F_CPU
+  return (uint32_t)calibratedFrameLength() * DLUSB_FRAME_CYCLES / OSCCAL_TARGET;
+}
+
+/// @brief Returns true once after the clock has been measured again, on USB reset or by
+///        the tracking window.
+bool DLUSBDevice::clockChanged() {
+  if (!clock_changed)
+    return false;
+
+  clock_changed = false;
+  return true;
 }
 
 /// @brief Wait a specified number of milliseconds (roughly), refreshing in the background
@@ -95,51 +281,62 @@ void DLUSBDevice::delay(long ms) {
   }
 }
 
-int DLUSBDevice::available() {
-  return (RING_BUFFER_SIZE + _rx_buffer->head - _rx_buffer->tail) % RING_BUFFER_SIZE;
+/// @brief Returns count of packets received from the host & waiting in rx_buffer
+uint8_t DLUSBDevice::available() {
+  return _rx_buffer->count();
 }
 
-int DLUSBDevice::tx_remaining() {
-  return RING_BUFFER_SIZE - (RING_BUFFER_SIZE + _tx_buffer->head - _tx_buffer->tail) % RING_BUFFER_SIZE;
+/// @brief Returns count of free tx_buffer slots
+uint8_t DLUSBDevice::tx_remaining() {
+  return DLUSB_TX_QUEUE_SIZE - _tx_buffer->count();
 }
 
 /// @brief Returns next packet from rx_buffer
 /// @param packet[out] pointer to a struct where packet will be copied to
 /// @return true if success, false if there are no new packets in ring buffer available
 bool DLUSBDevice::read(dlusb_packet_t* packet) {
-  // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer->head == _rx_buffer->tail) {
-    return false;
-  }
-  else {
-    memcpy(packet, &_rx_buffer->buffer[_rx_buffer->tail], sizeof(dlusb_packet_t));
-    _rx_buffer->tail = (_rx_buffer->tail + 1) % RING_BUFFER_SIZE;
-    return true;
-  }
+  return _rx_buffer->get(packet);
 }
 
 /// @brief Stores packet to tx_buffer
 /// @param packet[in] pointer to a struct of packet to store
 /// @return true if success, false if buffer is full
 bool DLUSBDevice::write(dlusb_packet_t* packet) {
-  return store_packet(packet, _tx_buffer);
+  return _tx_buffer->put(packet);
 }
 
-// TODO: Handle this better?
-int tx_available() {
-  return (RING_BUFFER_SIZE + tx_buffer.head - tx_buffer.tail) % RING_BUFFER_SIZE;
+/// @brief Returns data report (REPORT_ID_DATA) received from the host. Packet stays valid and
+///        further multi command & data reports are rejected until dataDone() are called.
+/// @return pointer to the packet or NULL if there's none
+dlusb_data_packet_t* DLUSBDevice::readData() {
+  return data_pending ? &long_buf.data : NULL;
 }
 
-bool tx_read(dlusb_packet_t* packet) {
-  // if the head isn't ahead of the tail, we don't have any characters
-  if (tx_buffer.head == tx_buffer.tail) {
-    return false;
-  }
-  else {
-    memcpy(packet, &tx_buffer.buffer[tx_buffer.tail], sizeof(dlusb_packet_t));
-    tx_buffer.tail = (tx_buffer.tail + 1) % RING_BUFFER_SIZE;
-    return true;
-  }
+/// @brief Releases data report returned by readData().
+void DLUSBDevice::dataDone() {
+  data_pending = false;
+}
+
+/// @brief Sets a function to be called when the host requests status report, to fill
+///        transmitter state. Queue fields are already filled, flags are cleared.
+/// @param statusCallback_ptr[in] Pointer to a function(dlusb_status_packet_t* status)
+void DLUSBDevice::onStatus(void (*statusCallback_ptr)(dlusb_status_packet_t* status)) {
+  status_callback = statusCallback_ptr;
+}
+
+/// @brief Sets a function to be called when the host reads REPORT_ID_DATA report, to fill
+///        cmd_id & data. Report are zeroed except report_id. Not called while a data report
+///        from the host are pending, the read fails then.
+/// @param dataCallback_ptr[in] Pointer to a function(dlusb_data_packet_t* data)
+void DLUSBDevice::onDataRead(void (*dataCallback_ptr)(dlusb_data_packet_t* data)) {
+  data_callback = dataCallback_ptr;
+}
+
+/// @brief Sets a function to be called when the host requests stats report, to fill transmitter
+///        & application counters. USB counters are already filled.
+/// @param statsCallback_ptr[in] Pointer to a function(dlusb_stats_packet_t* stats)
+void DLUSBDevice::onStats(void (*statsCallback_ptr)(dlusb_stats_packet_t* stats)) {
+  stats_callback = statsCallback_ptr;
 }
 
 
@@ -150,7 +347,7 @@ bool tx_read(dlusb_packet_t* packet) {
 #ifdef __cplusplus
 extern "C" {
 #endif 
-  PROGMEM const uchar usbHidReportDescriptor[25] = {    /* USB report descriptor */
+  PROGMEM const uchar usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH] = {    /* USB report descriptor */
     0x05, 0x84,                    // USAGE_PAGE (Power Device)
     0x09, 0x6b,                    // USAGE (SwitchOn/Off)
     0xa1, 0x01,                    // COLLECTION (Application)
@@ -162,8 +359,32 @@ extern "C" {
     0x75, 0x08,                    //   REPORT_SIZE (8)
     0x95, 0x07,                    //   REPORT_COUNT (7)
     0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+    0x09, 0x52,                    //   USAGE (ToggleControl)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x85, REPORT_ID_MULTI,         //   REPORT_ID (77)
+    0x09, 0x52,                    //   USAGE (ToggleControl)
+    0x95, 0x25,                    //   REPORT_COUNT (37)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+    0x85, REPORT_ID_STATUS,        //   REPORT_ID (78)
+    0x09, 0x52,                    //   USAGE (ToggleControl)
+    0x95, 0x07,                    //   REPORT_COUNT (7)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+    0x85, REPORT_ID_DATA,          //   REPORT_ID (79)
+    0x09, 0x52,                    //   USAGE (ToggleControl)
+    0x95, 0x25,                    //   REPORT_COUNT (37)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+    0x85, REPORT_ID_STATS,         //   REPORT_ID (80)
+    0x09, 0x52,                    //   USAGE (ToggleControl)
+    0x95, 0x1f,                    //   REPORT_COUNT (31)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
     0xc0                           // END_COLLECTION
   };
+  static_assert(sizeof(dlusb_packet_t) - 1 == 0x07, "REPORT_ID REPORT_COUNT must match dlusb_packet_t");
+  static_assert(sizeof(dlusb_multi_packet_t) - 1 == 0x25, "REPORT_ID_MULTI REPORT_COUNT must match dlusb_multi_packet_t");
+  static_assert(sizeof(dlusb_status_packet_t) - 1 == 0x07, "REPORT_ID_STATUS REPORT_COUNT must match dlusb_status_packet_t");
+  static_assert(sizeof(dlusb_data_packet_t) == sizeof(dlusb_multi_packet_t), "REPORT_ID_DATA REPORT_COUNT must match dlusb_data_packet_t");
+  static_assert(sizeof(dlusb_stats_packet_t) - 1 == 0x1f, "REPORT_ID_STATS REPORT_COUNT must match dlusb_stats_packet_t");
+  static_assert(sizeof(dlusb_times_packet_t) == sizeof(dlusb_packet_t), "CMD_TIMES are sent as REPORT_ID report");
 
   /* ------------------------------------------------------------------------- */
 
@@ -174,23 +395,68 @@ extern "C" {
     if ((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS) {    // HID class request
       // Host requests USB HID REPORT. Data: HOST <- DEVICE
       if (rq->bRequest == USBRQ_HID_GET_REPORT) {  // wValue: ReportType (highbyte), ReportID (lowbyte)
-        // Since we have only one report type, we can ignore the report-ID
-        static dlusb_packet_t packet[1];  // Buffer must stay valid when usbFunctionSetup returns
-        if (tx_available()) {
-          if (tx_read(&packet[0])) {
-            usbMsgPtr = (unsigned char*)packet; // Tell the driver which data to return
-            return sizeof(dlusb_packet_t); // Tell the driver to send packet
-          }
-          else
+        // Device state for the host flow control, doesn't touch the queues
+        if (rq->wValue.bytes[0] == REPORT_ID_STATUS) {
+          static dlusb_status_packet_t status;  // Buffer must stay valid when usbFunctionSetup returns
+          uint8_t rx_count = rx_buffer.count();
+
+          memset(&status, 0, sizeof(status));
+          status.report_id = REPORT_ID_STATUS;
+          status.cmd_id = CMD_STATUS;
+          status.rx_pending = rx_count;
+          status.rx_free = DLUSB_RX_QUEUE_SIZE - rx_count;
+          status.reply_free = DLUSB_TX_QUEUE_SIZE - tx_buffer.count();
+          if (status_callback != NULL)
+            status_callback(&status);
+
+          usbMsgPtr = (unsigned char*)&status;
+          return sizeof(status);
+        }
+
+        // Counters, USB ones are kept in the report buffer
+        if (rq->wValue.bytes[0] == REPORT_ID_STATS) {
+          stats.report_id = REPORT_ID_STATS;
+          stats.cmd_id = CMD_STATS;
+          stats.usb_resets = usbResetCount;
+          if (stats_callback != NULL)
+            stats_callback(&stats);
+
+          usbMsgPtr = (unsigned char*)&stats;
+          return sizeof(stats);
+        }
+
+        // Data for the host, filled by the application. Shares the buffer with the reports from the host.
+        if (rq->wValue.bytes[0] == REPORT_ID_DATA) {
+          if (data_callback == NULL || data_pending)
             return 0;
+
+          long_remaining = 0;
+          memset(&long_buf.data, 0, sizeof(long_buf.data));
+          long_buf.data.report_id = REPORT_ID_DATA;
+          data_callback(&long_buf.data);
+
+          usbMsgPtr = (unsigned char*)&long_buf.data;
+          return sizeof(long_buf.data);
         }
-        else {
-          // Drop through to return 0 (which will stall the request?)
+
+        // Otherwise it's the REPORT_ID report with the next reply
+        static dlusb_packet_t packet[1];  // Buffer must stay valid when usbFunctionSetup returns
+        if (tx_buffer.get(&packet[0])) {
+          usbMsgPtr = (unsigned char*)packet; // Tell the driver which data to return
+          return sizeof(dlusb_packet_t); // Tell the driver to send packet
         }
+        // Drop through to return 0 (which will stall the request?)
       }
       // Host sets USB HID REPORT. Data: HOST -> DEVICE
       else if (rq->bRequest == USBRQ_HID_SET_REPORT) {
-        // Since we have only one report type, we can ignore the report-ID
+        // Multi command & data reports span several usbFunctionWrite() calls
+        if (rq->wValue.bytes[0] == REPORT_ID_MULTI || rq->wValue.bytes[0] == REPORT_ID_DATA) {
+          long_len = 0;
+          long_remaining = (rq->wLength.word > sizeof(long_buf)) ? sizeof(long_buf) : rq->wLength.bytes[0];
+        }
+        else
+          long_remaining = 0;
+
         return USB_NO_MSG;  // use usbFunctionWrite() to receive data from host
       }
     }
@@ -203,11 +469,41 @@ extern "C" {
   // Called when hosts sends data to device, i.e. device receives HID report
   uchar  usbFunctionWrite(uchar* data, uchar len)
   {
+    if (long_remaining) {
+      // Buffer are taken by the data report until loop() releases it
+      if (data_pending) {
+        long_remaining = 0;
+        stats.rx_overflows++;
+        return 0xff;
+      }
+
+      if (len > long_remaining)
+        len = long_remaining;
+      memcpy((uint8_t*)&long_buf + long_len, data, len);
+      long_len += len;
+      long_remaining -= len;
+
+      if (long_remaining)
+        return 0; // Wait for the next chunk
+      if (long_buf.multi.report_id == REPORT_ID_MULTI)
+        return queue_multi(&long_buf.multi, long_len) ? 1 : 0xff;
+      else
+        return queue_data(&long_buf.data, long_len) ? 1 : 0xff;
+    }
+
     // Type cast incoming data to dlusb_packet_t struct
     dlusb_packet_t* p = (dlusb_packet_t*)data;
-    if (p->report_id == REPORT_ID && (p->cmd_id == CMD_SWITCH || p->cmd_id == CMD_SWITCH_OLD) )
-      if (!store_packet(p, &rx_buffer))
+    /* Unknown commands are queued as well, so loop() can reply with CMD_ERR_UNKNOWN
+     * tagged with the command seq number and the host doesn't wait for the ACK forever. */
+    if (p->report_id == REPORT_ID) {
+      intr_events = (p->status & DL_FLAG_INTR) != 0;
+      p->status &= ~(DLUSB_FLAG_MULTI | DLUSB_FLAG_MULTI_LAST);
+      if (!rx_buffer.put(p)) {
+        stats.rx_overflows++;
         return 0xff; // Return FAIL code
+      }
+      stats.commands++;
+    }
 
     return 1;
   }
@@ -22,35 +22,136 @@
 
 #include <util/delay.h> /* for _delay_ms() */
 
-/* Buffer size for USB TX & RX buffers. This is not the bytes, it's a count of dlusb_packet_t
- * structures it holds. I.e. how many packets it can store before processing. */
-#define RING_BUFFER_SIZE 16
-
-struct ring_buffer {
-  dlusb_packet_t buffer[RING_BUFFER_SIZE];
-  int head;
-  int tail;
+/* Depth of USB RX (commands from the host) & TX (replies) queues, in packets.
+ * Must be a power of two, up to 128. Every slot costs DLUSB_PAYLOAD_SIZE bytes of RAM. */
+#ifndef DLUSB_RX_QUEUE_SIZE
+  #define DLUSB_RX_QUEUE_SIZE 16
+#endif
+#ifndef DLUSB_TX_QUEUE_SIZE
+  #define DLUSB_TX_QUEUE_SIZE 8
+#endif
+
+// Fake USB disconnect time in begin(), ms
+#ifndef DLUSB_DISCONNECT_MS
+  #define DLUSB_DISCONNECT_MS 20
+#endif
+
+/* Runtime clock tracking: host polls of the interrupt IN endpoint go on its 1 ms frame boundaries,
+ * so CPU clock is measured with micros() against the frames between them over the window. Window
+ * is in host frames (ms), up to 60000, pause between the windows is in ms of the CPU clock. */
+#ifndef DLUSB_CLOCK_WINDOW_MS
+  #define DLUSB_CLOCK_WINDOW_MS 4096
+#endif
+#ifndef DLUSB_CLOCK_PAUSE_MS
+  #define DLUSB_CLOCK_PAUSE_MS 60000
+#endif
+// Poll is timed if refresh() saw the endpoint armed this many micros() before
+#define DLUSB_CLOCK_JITTER_US 256
+// Longer gaps between the polls aren't measured, frame count rounding might be wrong for them
+#define DLUSB_CLOCK_GAP_MAX_US 32768
+
+// CPU cycles per USB frame at exactly F_CPU
+#define DLUSB_FRAME_CYCLES (F_CPU / 1000)
+
+// Packet bytes kept in the queues, report_id are always REPORT_ID and not stored
+#define DLUSB_PAYLOAD_SIZE (sizeof(dlusb_packet_t) - 1)
+
+/* Flags set in the status field of the commands queued from the REPORT_ID_MULTI report.
+ * Cleared in the single commands, so host can't set them. */
+#define DLUSB_FLAG_MULTI 0x40 // Part of the multi command report, not ACKed on its own
+#define DLUSB_FLAG_MULTI_LAST 0x20 // Last command of the multi command report, ACKed with CMD_SWITCH_MULTI
+
+/* Profiling markers for the simulator (tools/dlsim -p). Writes marker ID to the unused
+ * GPIOR0 register, which costs one OUT instruction. Built only with -DDL_PROFILE. */
+#ifdef DL_PROFILE
+  #define DL_PROFILE_MARK(id) (GPIOR0 = (id))
+#else
+  #define DL_PROFILE_MARK(id)
+#endif
+
+#define DL_PROFILE_USBPOLL 1 // usbPoll() called
+
+/* Single producer, single consumer ring of packets. Producer only writes head, consumer
+ * only writes tail, both are 8 bit so updates are atomic & either side can run from an ISR
+ * without disabling interrupts. Indexes run freely & wrap at 256, slot are selected with
+ * a mask, so all SIZE slots are usable. */
+template <uint8_t SIZE>
+struct dlusb_ring {
+  static_assert(SIZE != 0 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "Queue size must be a power of two, up to 128");
+
+  uint8_t slot[SIZE][DLUSB_PAYLOAD_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+
+  /// @brief Returns count of packets in the ring.
+  uint8_t count() const {
+    return (uint8_t)(head - tail);
+  }
+
+  /// @brief Stores packet in the ring. Producer side.
+  /// @param[in] packet stored packet struct, report_id are not stored
+  /// @return true if success, false if ring is full
+  bool put(const dlusb_packet_t* packet) {
+    uint8_t h = head;
+    if ((uint8_t)(h - tail) == SIZE)
+      return false;
+
+    memcpy(slot[h & (SIZE - 1)], &packet->cmd_id, DLUSB_PAYLOAD_SIZE);
+    // Slot must be filled before it's published to the consumer
+    asm volatile("" ::: "memory");
+    head = h + 1;
+    return true;
+  }
+
+  /// @brief Takes next packet from the ring. Consumer side.
+  /// @param[out] packet struct where packet will be copied to, report_id are set to REPORT_ID
+  /// @return true if success, false if ring is empty
+  bool get(dlusb_packet_t* packet) {
+    uint8_t t = tail;
+    if (t == head)
+      return false;
+
+    packet->report_id = REPORT_ID;
+    memcpy(&packet->cmd_id, slot[t & (SIZE - 1)], DLUSB_PAYLOAD_SIZE);
+    // Slot must be read before it's released to the producer
+    asm volatile("" ::: "memory");
+    tail = t + 1;
+    return true;
+  }
 };
 
+typedef dlusb_ring<DLUSB_RX_QUEUE_SIZE> dlusb_rx_ring_t;
+typedef dlusb_ring<DLUSB_TX_QUEUE_SIZE> dlusb_tx_ring_t;
+
 /// @brief Class for interfacing with USB
 class DLUSBDevice {
 private:
-  ring_buffer* _rx_buffer;
-  ring_buffer* _tx_buffer;
+  dlusb_rx_ring_t* _rx_buffer;
+  dlusb_tx_ring_t* _tx_buffer;
 
 public:
-  DLUSBDevice(ring_buffer* rx_buffer, ring_buffer* tx_buffer);
+  DLUSBDevice(dlusb_rx_ring_t* rx_buffer, dlusb_tx_ring_t* tx_buffer);
 
   void begin();
 
   void refresh();
   void delay(long milliseconds);
 
-  int available();
-  int tx_remaining();
+  uint8_t available();
+  uint8_t tx_remaining();
 
   bool read(dlusb_packet_t* packet);
   bool write(dlusb_packet_t* packet);
+
+  dlusb_data_packet_t* readData();
+  void dataDone();
+
+  void onStatus(void (*statusCallback_ptr)(dlusb_status_packet_t* status));
+  void onDataRead(void (*dataCallback_ptr)(dlusb_data_packet_t* data));
+  void onStats(void (*statsCallback_ptr)(dlusb_stats_packet_t* stats));
+
+  uint16_t clockFrameCycles();
+  bool clockChanged();
 };
 
 extern DLUSBDevice DLUSB;
@@ -8,6 +8,7 @@
  */
 
 #include <avr/io.h>
+#include <avr/eeprom.h>
 #include "usbdrv.h" // for usbMeasureFrameLength()
 
 #ifndef uchar
@@ -18,16 +19,78 @@
 /* ------------------------ Oscillator Calibration ------------------------- */
 /* ------------------------------------------------------------------------- */
 
+/* Frame length measured at the final OSCCAL by the last calibration, see
+ * calibratedFrameLength(). */
+static unsigned calibratedLength;
+
+/* Returns deviation of the measured frame length from the target. */
+static int  frameDeviation(void)
+{
+int         x = usbMeasureFrameLength() - OSCCAL_TARGET;
+
+    return x < 0 ? -x : x;
+}
+
+/* Applies OSCCAL value stored by the last calibration, so the CPU runs close to
+ * F_CPU right from the reset, before the host resets the bus.
+ */
+void    loadOscillator(void)
+{
+uchar       cached = eeprom_read_byte((uchar *)OSCCAL_EEPROM_ADDR);
+
+    if(cached != OSCCAL_NONE)
+        OSCCAL = cached;
+}
+
+/* Walks OSCCAL from the current value in the direction where frame length
+ * deviation decreases, up to OSCCAL_REFINE_STEPS steps each way.
+ */
+static void neighborhoodSearch(void)
+{
+uchar       optimumValue = OSCCAL, i;
+int         x, optimumDev = frameDeviation();
+signed char dir;
+
+    for(dir = -1; dir <= 1; dir += 2){
+        for(i = 0; i < OSCCAL_REFINE_STEPS; i++){
+            /* OSCCAL_NONE is never stored, it marks empty EEPROM */
+            if((dir < 0 && optimumValue == 0) || (dir > 0 && optimumValue == OSCCAL_NONE - 1))
+                break;
+            OSCCAL = optimumValue + dir;
+            x = frameDeviation();
+            if(x >= optimumDev)
+                break;
+            optimumDev = x;
+            optimumValue = OSCCAL;
+        }
+    }
+    OSCCAL = optimumValue;
+}
+
 /* Calibrate the RC oscillator. Our timing reference is the Start Of Frame
  * signal (a single SE0 bit) repeating every millisecond immediately after
- * a USB RESET. We first do a binary search for the OSCCAL value and then
- * optimize this value with a neighboorhod search.
+ * a USB RESET. If the value stored by the previous calibration is still
+ * within OSCCAL_CACHE_TOLERANCE, it's only refined in its neighborhood.
+ * Otherwise we first do a binary search for the OSCCAL value and then
+ * optimize this value with a neighboorhod search. Result is stored in EEPROM
+ * for the next reset.
  */
 void    calibrateOscillator(void)
 {
 uchar       step = 128;
 uchar       trialValue = 0, optimumValue;
-int         x, optimumDev, targetValue = (unsigned)(1499 * (double)F_CPU / 10.5e6 + 0.5);
+int         x, optimumDev, targetValue = OSCCAL_TARGET;
+uchar       cached = eeprom_read_byte((uchar *)OSCCAL_EEPROM_ADDR);
+
+    /* Oscillator drifts only with temperature & supply voltage, stored value
+     * takes a few frames to refine instead of ~11 for the full search. */
+    if(cached != OSCCAL_NONE){
+        OSCCAL = cached;
+        if(frameDeviation() <= targetValue / OSCCAL_CACHE_TOLERANCE){
+            neighborhoodSearch();
+            goto store;
+        }
+    }
 
     /* do a binary search: */
     do{
@@ -51,7 +114,33 @@ int         x, optimumDev, targetValue = (unsigned)(1499 * (double)F_CPU / 10.5e
         }
     }
     OSCCAL = optimumValue;
+
+store:
+    /* Measured once more for the RF timing scaling, while the bus is still
+     * idle after the reset. */
+    calibratedLength = usbMeasureFrameLength();
+    /* Only written when changed. Doesn't wait unless other EEPROM write is
+     * in progress, takes ~3.4 ms in background. */
+    if(OSCCAL != OSCCAL_NONE)
+        eeprom_update_byte((uchar *)OSCCAL_EEPROM_ADDR, OSCCAL);
 }
+
+/* Returns frame length measured by the last calibration (OSCCAL_TARGET at
+ * exactly F_CPU), i.e. the remaining clock error after it, or 0 if there was
+ * no calibration or no frames on the bus. The measurement can only be done
+ * right after the USB reset: it keeps interrupts disabled for up to 2 frames
+ * & counts any EOP on the bus as a frame boundary.
+ */
+unsigned    calibratedFrameLength(void)
+{
+int         dev = (int)calibratedLength - OSCCAL_TARGET;
+
+    /* timeout, no frames on the bus */
+    if(dev > OSCCAL_TARGET / 16 || dev < -OSCCAL_TARGET / 16)
+        return 0;
+    return calibratedLength;
+}
+
 /*
 Note: This calibration algorithm may try OSCCAL values of up to 192 even if
 the optimum value is far below 192. It may therefore exceed the allowed clock
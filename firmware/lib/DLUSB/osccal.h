@@ -21,11 +21,32 @@ USB_CFG_HAVE_MEASURE_FRAME_LENGTH to 1. It is recommended to call
 calibrateOscillator() from the reset hook in usbconfig.h:
 */
 
+/* EEPROM address where the last calibration result are stored. 0xFF (erased EEPROM)
+ * means no stored value, it's never stored as it's far above 16.5 MHz anyway. */
+#define OSCCAL_EEPROM_ADDR      0x00
+#define OSCCAL_NONE             0xff
+/* Stored value are refined if it gives frame length within 1/OSCCAL_CACHE_TOLERANCE
+ * of the target (2%, a few OSCCAL steps), full search is done otherwise. */
+#define OSCCAL_CACHE_TOLERANCE  50
+// Max OSCCAL steps from the stored value in each direction
+#define OSCCAL_REFINE_STEPS     8
+// usbMeasureFrameLength() result at exactly F_CPU
+#define OSCCAL_TARGET           (int)(1499 * (double)F_CPU / 10.5e6 + 0.5)
+
 #ifndef __ASSEMBLER__
 #include <avr/interrupt.h>  // for sei()
+#ifdef __cplusplus
+extern "C" {
+#endif
 extern void calibrateOscillator(void);
+extern void loadOscillator(void);
+extern unsigned calibratedFrameLength(void);
+extern unsigned usbResetCount;  // USB resets seen by USB_RESET_HOOK, defined in DLUSB.cpp
+#ifdef __cplusplus
+} // extern "C"
+#endif
 #endif
-#define USB_RESET_HOOK(resetStarts)  if(!resetStarts){cli(); calibrateOscillator(); sei();}
+#define USB_RESET_HOOK(resetStarts)  if(!resetStarts){cli(); calibrateOscillator(); sei(); usbResetCount++;}
 
 /*
 This routine is an alternative to the continuous synchronization described
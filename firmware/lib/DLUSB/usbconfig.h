@@ -200,7 +200,7 @@ section at the end of this file).
  * with libusb: 0x16c0/0x5dc.  Use this VID/PID pair ONLY if you understand
  * the implications!
  */
-#define USB_CFG_DEVICE_VERSION  0x02, 0x02
+#define USB_CFG_DEVICE_VERSION  0x00, 0x03
 /* Version number of the device: Minor number first, then major number.
  */
 #define USB_CFG_VENDOR_NAME     'd','i','g','i','l','i','v','o','l','o','@','y','a','n','d','e','x','.','c','o','m'
@@ -245,7 +245,7 @@ section at the end of this file).
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH   25
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH   65
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  * If you use this define, you must add a PROGMEM character array named
@@ -21,6 +21,7 @@
 #include <Arduino.h>
 #include <DLUSB.h>
 #include <DLTransmitter.h>
+#include <DLScenes.h>
 #include <stdint.h>
 
 /* Pin currently set at compile time in DLTransmitter.h. When it defined there, pin from the constructor
@@ -30,6 +31,26 @@ DLTransmitter dltransmitter(PIN_B5);
 
 dlusb_packet_t in_buf, out_buf; // Input & outpus USB packet buffers
 
+/* Commands queued to the transmitter, kept to be sent back as ACKs when done.
+ * Transmitter completes codes in the queue order, so the slots are used round-robin
+ * and slot index are passed as a tag. */
+dlusb_packet_t tx_pending[DLTRANSMIT_QUEUE_SIZE];
+uint8_t tx_pending_next = 0;
+// millis() when the commands in tx_pending slots has been read from DLUSB, for CMD_TIMES
+unsigned long tx_received[DLTRANSMIT_QUEUE_SIZE];
+
+// Transmitter tag of the scene button codes, outside of the tx_pending slots
+#define TAG_SCENE DLTRANSMIT_QUEUE_SIZE
+
+DLScenes scenes;
+// CMD_SCENE being played & CMD_SCENE_WRITE being written, kept to be sent back as ACKs when done
+dlusb_packet_t scene_cmd, write_cmd;
+
+// Counters for the stats report, see dlusb_stats_packet_t
+uint32_t unknown_cmds = 0;
+uint32_t loop_max_us = 0;
+unsigned long loop_started = 0; // micros() of the current loop() iteration start
+
 /// @brief Populates dlusb_packet_t struct with RDY packet which are sent
 ///        to the host from setup() on device powerup/reset to signal the
 ///        host software that the device are ready.
@@ -41,14 +62,192 @@ void mk_rdy_packet(dlusb_packet_t* packet) {
   // Just some unused "magic" data to test connection below.
   packet->remote_id = 0xABCD;
   packet->btn_id = 0xEF;
+
+  // Not a reply to any command
+  packet->seq = 0;
+  packet->status = DL_STATUS_OK;
+}
+
+
+/// @brief Sends ACK for the processed command. Commands from the multi command report
+///        are ACKed once, with CMD_SWITCH_MULTI reply after the last one.
+/// @param packet[in,out] command packet, turned into the reply
+void ack(dlusb_packet_t* packet) {
+  if (packet->status & DLUSB_FLAG_MULTI)
+    return;
+
+  if (packet->status & DLUSB_FLAG_MULTI_LAST) {
+    packet->cmd_id = CMD_SWITCH_MULTI;
+    packet->remote_id = 0;
+    packet->btn_id = 0;
+  }
+
+  /* Send back same packet so that the host software can acknowledge it was
+   * processed by the device. Seq number set by the host are echoed as is. */
+  packet->status = DL_STATUS_OK;
+  DLUSB.write(packet);
+}
+
+/// @brief Sends CMD_TIMES report after the ACK, for the commands with DL_FLAG_TIMES set.
+///        Transmit end is now, it's called right after the last frame.
+/// @param seq[in] sequence number of the command
+/// @param received[in] millis() when the command has been read from DLUSB
+void send_times(uint8_t seq, unsigned long received) {
+  unsigned long started = dltransmitter.burstStart();
+  dlusb_times_packet_t times;
+  times.report_id = REPORT_ID;
+  times.cmd_id = CMD_TIMES;
+  times.queue_ms = started - received;
+  times.reserved = 0;
+  times.seq = seq;
+  times.air_ms = millis() - started;
+  DLUSB.write((dlusb_packet_t*)&times);
+}
+
+/// @brief Sends error reply to the command.
+/// @param packet[in,out] command packet, turned into the reply
+/// @param status[in] DL_STATUS_ERR_* code
+void reply_error(dlusb_packet_t* packet, uint8_t status) {
+  packet->status = status;
+  DLUSB.write(packet);
 }
 
+/// @brief Called by the transmitter when all repeats of the button code has been sent.
+/// @param tag[in] tx_pending slot of the command or TAG_SCENE
+void tx_done(uint8_t tag) {
+  if (tag == TAG_SCENE)
+    scenes.sent();
+  else {
+    bool times = tx_pending[tag].status & DL_FLAG_TIMES;
+    ack(&tx_pending[tag]);
+    if (times)
+      send_times(tx_pending[tag].seq, tx_received[tag]);
+  }
+}
+
+/// @brief Sends button code with the original blocking method, after the queued codes.
+/// @param remote_id[in] Remote ID
+/// @param btn_id[in] Key code
+void send_old(uint16_t remote_id, uint8_t btn_id) {
+  // Old method blocks, let queued codes go first.
+  while (dltransmitter.busy()) {
+    DLUSB.refresh();
+    dltransmitter.task();
+  }
 
-/// @brief Wrapper for a member function DLUSB.refresh() to be called from a non-member class
-void DLUSB_refresh_wrapper() {
+  digitalWrite(LED_BUILTIN, HIGH);
+  dltransmitter.sendButton(remote_id, btn_id, false);
+}
+
+/// @brief Services USB while waiting, passed to the blocking calls.
+void usb_refresh() {
   DLUSB.refresh();
 }
 
+/// @brief Advances playing scene, doesn't block unless scene has codes to be sent with
+///        the original method.
+void scenes_task() {
+  dl_tuple_t tuple;
+
+  // Scene codes go when the transmitter is idle, commands from the host can get in between
+  if (!dltransmitter.busy() && scenes.next(&tuple)) {
+    if ((tuple.flags & DL_TUPLE_FLAG_OLD) || !dltransmitter.enqueue(tuple.remote_id, tuple.btn_id, TAG_SCENE)) {
+      send_old(tuple.remote_id, tuple.btn_id);
+      scenes.sent();
+    }
+  }
+
+  if (scenes.finished())
+    ack(&scene_cmd);
+}
+
+/// @brief Processes data reports from the host: scene table writes & RF timing profile.
+void data_task() {
+  if (scenes.writing()) {
+    if (scenes.task()) {
+      DLUSB.dataDone();
+      ack(&write_cmd);
+    }
+    return;
+  }
+
+  dlusb_data_packet_t* data = DLUSB.readData();
+  if (data == NULL)
+    return;
+
+  write_cmd.report_id = REPORT_ID;
+  write_cmd.cmd_id = data->cmd_id;
+  write_cmd.remote_id = data->offset;
+  write_cmd.btn_id = 0;
+  write_cmd.seq = data->seq;
+  write_cmd.status = DL_STATUS_OK;
+
+  if (data->cmd_id == CMD_SCENE_WRITE) {
+    // Block of the scene table, written to EEPROM byte by byte from here
+    if (scenes.playing())
+      reply_error(&write_cmd, DL_STATUS_ERR_BUSY);
+    else if (!scenes.write(data->offset, data->data))
+      reply_error(&write_cmd, DL_STATUS_ERR_RANGE);
+    else
+      return; // Buffer are released when written
+  }
+  else if (data->cmd_id == CMD_TIMING_WRITE) {
+    // Takes effect from the next burst, it's only a few bytes to store
+    dl_timing_t timing;
+    memcpy(&timing, data->data, sizeof(timing));
+    DLUSB.dataDone();
+
+    if (!dltransmitter.setTiming(&timing))
+      reply_error(&write_cmd, DL_STATUS_ERR_RANGE);
+    else {
+      dltransmitter.saveTiming(&timing, &usb_refresh);
+      ack(&write_cmd);
+    }
+    return;
+  }
+  else {
+    write_cmd.cmd_id = CMD_ERR_UNKNOWN;
+    reply_error(&write_cmd, DL_STATUS_ERR_UNKNOWN);
+    unknown_cmds++;
+  }
+
+  DLUSB.dataDone();
+}
+
+/// @brief Called by DLUSB when the host reads data report, fills RF timing profile.
+/// @param data[in,out] zeroed data report
+void fill_data(dlusb_data_packet_t* data) {
+  data->cmd_id = CMD_TIMING;
+  dltransmitter.getTiming((dl_timing_t*)data->data);
+}
+
+/// @brief Passes the clock measured on USB reset & tracked against the host polls to the
+///        transmitter, so RF pulse widths of the next bursts are corrected for the clock drift.
+void clock_task() {
+  if (DLUSB.clockChanged())
+    dltransmitter.setClock(DLUSB.clockFrameCycles(), DLUSB_FRAME_CYCLES);
+}
+
+/// @brief Called by DLUSB when the host requests status report, fills transmitter state.
+/// @param status[in,out] status report with the USB queues state filled
+void fill_status(dlusb_status_packet_t* status) {
+  status->rf_queued = dltransmitter.queued();
+  if (scenes.playing())
+    status->flags |= DL_STATE_SCENE;
+  if (dltransmitter.onAir()) {
+    status->flags |= DL_STATE_RF_ON_AIR;
+    status->rf_repeats_left = dltransmitter.repeatsLeft();
+  }
+}
+
+/// @brief Called by DLUSB when the host requests stats report, fills transmitter & loop counters.
+/// @param stats[in,out] stats report with the USB counters filled
+void fill_stats(dlusb_stats_packet_t* stats) {
+  dltransmitter.getStats(stats);
+  stats->unknown = unknown_cmds;
+  stats->loop_max_us = loop_max_us;
+}
+
 void setup() {
   DLUSB.begin();
   DLUSB.refresh();
@@ -60,46 +259,70 @@ void setup() {
 
   pinMode(LED_BUILTIN, OUTPUT);
   digitalWrite(LED_BUILTIN, LOW);
+  dltransmitter.loadTiming();
+  dltransmitter.onDone(&tx_done);
+  DLUSB.onStatus(&fill_status);
+  DLUSB.onDataRead(&fill_data);
+  DLUSB.onStats(&fill_stats);
   DLUSB.refresh();
 }
 
 void loop() {
-  DLUSB.refresh();
-
-  // Read data from host if available.
-  if (DLUSB.available()) {
-    // Turn on the LED to indicate received USB packet.
-    digitalWrite(LED_BUILTIN, HIGH);
-
-    if (DLUSB.read(&in_buf)) {
-      DLUSB.refresh();
+  // Iteration time includes blocking old method transmits & EEPROM writes
+  unsigned long now = micros();
+  if (loop_started != 0 && now - loop_started > loop_max_us)
+    loop_max_us = now - loop_started;
+  loop_started = now;
 
-      if (in_buf.cmd_id == CMD_SWITCH || in_buf.cmd_id == CMD_SWITCH_OLD) {
-        // Transmit Livolo code
-        if (in_buf.cmd_id == CMD_SWITCH) // New method
-          dltransmitter.sendButton(in_buf.remote_id, in_buf.btn_id, true, &DLUSB_refresh_wrapper);
-        else if (in_buf.cmd_id == CMD_SWITCH_OLD) // Old method
-          dltransmitter.sendButton(in_buf.remote_id, in_buf.btn_id);
+  DLUSB.refresh();
+  dltransmitter.task();
+  scenes_task();
+  data_task();
+  clock_task();
 
-        DLUSB.refresh();
+  // LED are on while the button codes are transmitted
+  digitalWrite(LED_BUILTIN, dltransmitter.busy() ? HIGH : LOW);
 
-        /* Send back same packet so that the host software can acknowledge it was
-         * processed by the device. */
-        DLUSB.write(&in_buf);
-      }
+  // Read data from host if available & transmitter can take it.
+  if (DLUSB.available() && !dltransmitter.full() && DLUSB.read(&in_buf)) {
+    unsigned long received = millis();
+    if (in_buf.cmd_id == CMD_SWITCH) {
+      // New method, transmitted in background by the Timer ISRs
+      memcpy(&tx_pending[tx_pending_next], &in_buf, sizeof(in_buf));
+      tx_received[tx_pending_next] = received;
+      if (dltransmitter.enqueue(in_buf.remote_id, in_buf.btn_id, tx_pending_next, in_buf.repeats))
+        tx_pending_next = (tx_pending_next + 1) % DLTRANSMIT_QUEUE_SIZE;
       else {
-        memcpy(&out_buf, &in_buf, sizeof(in_buf));
-        out_buf.cmd_id = CMD_ERR_UNKNOWN;
-        DLUSB.write(&out_buf);
+        // Timer unavailable, fallback to the blocking method
+        dltransmitter.sendButton(in_buf.remote_id, in_buf.btn_id, false);
+        tx_done(tx_pending_next);
       }
-      
-      /* Sleep for 100ms after receiving packet & transmitting the keycode. We
-       * don't need to send codes more often. Makes LED blink noticable. */
-      DLUSB.delay(100);
     }
-    digitalWrite(LED_BUILTIN, LOW); // LED off
-  }
+    else if (in_buf.cmd_id == CMD_SWITCH_OLD) {
+      send_old(in_buf.remote_id, in_buf.btn_id);
+      bool times = in_buf.status & DL_FLAG_TIMES;
+      ack(&in_buf);
+      if (times)
+        send_times(in_buf.seq, received);
 
-  // Sleep for 50ms between checking for packets from the host.
-  DLUSB.delay(50);
+      // Makes LED blink noticable & keeps a pause before the next code.
+      DLUSB.delay(dltransmitter.gap());
+    }
+    else if (in_buf.cmd_id == CMD_SCENE) {
+      // Played in background from scenes_task(), ACKed when all codes are sent
+      if (scenes.playing() || scenes.writing())
+        reply_error(&in_buf, DL_STATUS_ERR_BUSY);
+      else if (!scenes.play(in_buf.btn_id))
+        reply_error(&in_buf, DL_STATUS_ERR_SCENE);
+      else
+        memcpy(&scene_cmd, &in_buf, sizeof(in_buf));
+    }
+    else {
+      memcpy(&out_buf, &in_buf, sizeof(in_buf));
+      out_buf.cmd_id = CMD_ERR_UNKNOWN;
+      out_buf.status = DL_STATUS_ERR_UNKNOWN;
+      DLUSB.write(&out_buf);
+      unknown_cmds++;
+    }
+  }
 }
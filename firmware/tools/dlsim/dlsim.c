@@ -0,0 +1,743 @@
+/* Part of the DigiLivolo firmware.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Runs the firmware ELF in simavr, feeds commands into rx_buffer the same way
+ * usbFunctionWrite() does, records TX pin edges & decodes them back into
+ * Livolo remote ID & keycode with a timing error report. Optionally profiles
+ * ISR cycles, USB ISR latency & usbPoll() call gaps. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <gelf.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_vcd_file.h"
+#include "avr_ioport.h"
+
+#include "defs.h"
+
+#define DLSIM_MCU "attiny85"
+#define DLSIM_FREQ 16500000
+
+// TX pin, DL_STATIC_PIN in DLTransmitter.h
+#define DLSIM_TX_PORT 'B'
+#define DLSIM_TX_PIN 5
+
+/* Firmware dlusb_ring layout (see DLUSB.h): SIZE slots of dlusb_packet_t without
+ * report_id (7 bytes), followed by uint8_t head & uint8_t tail, which run freely. */
+#define DLSIM_RX_SIZE 16 // DLUSB_RX_QUEUE_SIZE
+#define DLSIM_TX_SIZE 8 // DLUSB_TX_QUEUE_SIZE
+#define DLSIM_PAYLOAD_SIZE 7
+#define DLSIM_RING_HEAD(size) ((size) * DLSIM_PAYLOAD_SIZE)
+#define DLSIM_RING_TAIL(size) (DLSIM_RING_HEAD(size) + 1)
+
+// Frames per button code, DLTRANSMIT_REPEATS + 1
+#define DLSIM_FRAMES 129
+// Data bits per frame: 16 bits of remote ID & 7 bits of keycode
+#define DLSIM_FRAME_BITS 23
+
+// Edges further apart than this are different bursts, us
+#define DLSIM_BURST_GAP_US 10000.0
+
+// ATtiny85 interrupt vectors, one word each
+#define DLSIM_VECTORS 15
+#define DLSIM_VEC_USB 2 // PCINT0, USB_INTR_VECTOR
+
+// USB pins, see usbboardconfig.h
+#define DLSIM_USB_PORT 'B'
+#define DLSIM_USB_DMINUS_PIN 3
+#define DLSIM_USB_DPLUS_PIN 4
+
+// DL_PROFILE_MARK() in DLUSB.h writes to GPIOR0 (data space address)
+#define DLSIM_GPIOR0 0x31
+#define DLSIM_MARK_USBPOLL 1 // DL_PROFILE_USBPOLL
+
+#define DLSIM_OP_RETI 0x9518
+#define DLSIM_ISR_NESTING 8
+
+// D+ edges are injected at random intervals in this range during the RF burst, us
+#define DLSIM_DPLUS_MIN_US 200
+#define DLSIM_DPLUS_MAX_US 1200
+
+// All commands are put into rx_buffer at once
+#define DLSIM_MAX_CMDS DLSIM_RX_SIZE
+
+/// @brief Livolo pulse classes.
+typedef enum {
+	PULSE_GLITCH = 0, // Too short, pin set high right after the frame end edge
+	PULSE_ZERO, // Half of the 0 bit
+	PULSE_ONE, // 1 bit
+	PULSE_START, // Start pulse
+	PULSE_LONG, // Longer than a start pulse, gap between bursts
+	PULSE_CLASSES
+} pulse_class_t;
+
+static const char* const pulse_names[PULSE_CLASSES] = { "glitch", "zero", "one", "start", "long" };
+
+static const char* const vector_names[DLSIM_VECTORS] = {
+	"RESET", "INT0", "PCINT0", "TIMER1_COMPA", "TIMER1_OVF", "TIMER0_OVF", "EE_RDY", "ANA_COMP",
+	"ADC", "TIMER1_COMPB", "TIMER0_COMPA", "TIMER0_COMPB", "WDT", "USI_START", "USI_OVF"
+};
+
+/// @brief Running statistics of the pulse timing error.
+typedef struct {
+	uint32_t count;
+	double sum, sum_sq, min, max;
+} stat_t;
+
+/// @brief Command injected into the firmware.
+typedef struct {
+	uint16_t remote_id;
+	uint8_t btn_id;
+	uint8_t seq;
+	bool acked;
+	double t_sent, t_ack; // us
+} sim_cmd_t;
+
+/// @brief Decoded burst of frames.
+typedef struct {
+	double t_first, t_last; // First & last edge, us
+	uint32_t frames, errors;
+	uint16_t remote_id;
+	uint8_t btn_id;
+	bool code_set, mixed; // mixed - frames with different codes in one burst
+	double last_start; // Start of the previous frame, us
+	stat_t period; // Frame period
+} burst_t;
+
+// Recorded edges: time, us & pin level after the edge
+typedef struct {
+	double* t;
+	uint8_t* level;
+	size_t count, size;
+} edges_t;
+
+/// @brief Profiler state.
+typedef struct {
+	bool enabled, active; // active - commands were sent, collecting stats
+	stat_t isr[DLSIM_VECTORS]; // Cycles spent in the ISR, excluding nested ISRs
+	struct {
+		int vector;
+		avr_cycle_count_t entry, nested; // nested - cycles spent in nested ISRs
+	} stack[DLSIM_ISR_NESTING];
+	int depth, max_depth;
+	avr_irq_t* dplus;
+	uint32_t dplus_level;
+	avr_cycle_count_t dplus_edge; // D+ edge waiting for the USB ISR entry, 0 if none
+	stat_t usb_latency; // D+ edge to USB ISR entry, cycles
+	avr_cycle_count_t last_poll;
+	stat_t poll_gap; // Between usbPoll() calls, us
+	uint32_t rng;
+} profile_t;
+
+static edges_t edges;
+static profile_t prof;
+// Nominal pulse durations, us
+static double nominal[PULSE_CLASSES] = { 0, 100, 300, 500, 0 };
+static avr_t* avr;
+
+/// @brief Returns simulated time in microseconds.
+static double sim_us(void) {
+	return (double)avr->cycle * 1000000.0 / avr->frequency;
+}
+
+static void stat_add(stat_t* s, double v) {
+	if (s->count == 0 || v < s->min)
+		s->min = v;
+	if (s->count == 0 || v > s->max)
+		s->max = v;
+	s->count++;
+	s->sum += v;
+	s->sum_sq += v * v;
+}
+
+static double stat_avg(const stat_t* s) {
+	return s->count ? s->sum / s->count : 0.0;
+}
+
+static double stat_stddev(const stat_t* s) {
+	if (s->count < 2)
+		return 0.0;
+	double avg = stat_avg(s);
+	double var = s->sum_sq / s->count - avg * avg;
+	return var > 0 ? sqrt(var) : 0.0;
+}
+
+/// @brief simavr IRQ callback, records TX pin edges.
+static void pin_changed(struct avr_irq_t* irq, uint32_t value, void* param) {
+	(void)irq;
+	(void)param;
+
+	if (edges.count && edges.level[edges.count - 1] == (value ? 1 : 0))
+		return;
+
+	if (edges.count == edges.size) {
+		edges.size = edges.size ? edges.size * 2 : 65536;
+		edges.t = realloc(edges.t, edges.size * sizeof(*edges.t));
+		edges.level = realloc(edges.level, edges.size * sizeof(*edges.level));
+		if (!edges.t || !edges.level) {
+			fprintf(stderr, "ERROR: out of memory\n");
+			exit(2);
+		}
+	}
+
+	edges.t[edges.count] = sim_us();
+	edges.level[edges.count] = value ? 1 : 0;
+	edges.count++;
+}
+
+/// @brief Looks up a symbol address in the ELF file.
+/// @param path[in] ELF file path
+/// @param name[in] symbol name
+/// @return Data space address or 0 if not found
+static uint32_t elf_symbol(const char* path, const char* name) {
+	uint32_t addr = 0;
+	Elf_Scn* scn = NULL;
+	int fd;
+	Elf* e;
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		return 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if (!(e = elf_begin(fd, ELF_C_READ, NULL))) {
+		close(fd);
+		return 0;
+	}
+
+	while (!addr && (scn = elf_nextscn(e, scn)) != NULL) {
+		GElf_Shdr shdr;
+		if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB)
+			continue;
+
+		Elf_Data* data = elf_getdata(scn, NULL);
+		size_t n = shdr.sh_size / shdr.sh_entsize;
+		for (size_t i = 0; i < n; i++) {
+			GElf_Sym sym;
+			if (!gelf_getsym(data, (int)i, &sym))
+				continue;
+			const char* sname = elf_strptr(e, shdr.sh_link, sym.st_name);
+			if (sname && strcmp(sname, name) == 0) {
+				// RAM addresses are offset by 0x800000 in AVR ELF files
+				addr = (uint32_t)(sym.st_value & 0xFFFF);
+				break;
+			}
+		}
+	}
+
+	elf_end(e);
+	close(fd);
+	return addr;
+}
+
+/// @brief Stores packet into firmware rx_buffer, like dlusb_ring::put() does from usbFunctionWrite().
+static bool inject(uint32_t rx_buffer, const sim_cmd_t* cmd) {
+	uint8_t head = avr->data[rx_buffer + DLSIM_RING_HEAD(DLSIM_RX_SIZE)];
+	uint8_t tail = avr->data[rx_buffer + DLSIM_RING_TAIL(DLSIM_RX_SIZE)];
+	uint8_t* p = &avr->data[rx_buffer + (head & (DLSIM_RX_SIZE - 1)) * DLSIM_PAYLOAD_SIZE];
+
+	if ((uint8_t)(head - tail) == DLSIM_RX_SIZE)
+		return false;
+
+	p[0] = CMD_SWITCH;
+	p[1] = cmd->remote_id & 0xFF;
+	p[2] = cmd->remote_id >> 8;
+	p[3] = cmd->btn_id;
+	p[4] = cmd->seq;
+	p[5] = 0;
+	p[6] = 0; // Default repeats, DLSIM_FRAMES are expected
+
+	avr->data[rx_buffer + DLSIM_RING_HEAD(DLSIM_RX_SIZE)] = head + 1;
+	return true;
+}
+
+/// @brief Takes replies from firmware tx_buffer as the host does & looks for ACKs.
+static void check_acks(uint32_t tx_buffer, sim_cmd_t* cmds, int ncmds) {
+	uint8_t head = avr->data[tx_buffer + DLSIM_RING_HEAD(DLSIM_TX_SIZE)];
+	uint8_t tail = avr->data[tx_buffer + DLSIM_RING_TAIL(DLSIM_TX_SIZE)];
+
+	for (; tail != head; tail++) {
+		const uint8_t* p = &avr->data[tx_buffer + (tail & (DLSIM_TX_SIZE - 1)) * DLSIM_PAYLOAD_SIZE];
+		for (int c = 0; c < ncmds; c++) {
+			if (!cmds[c].acked && p[0] == CMD_SWITCH && p[4] == cmds[c].seq && \
+				(p[1] | (p[2] << 8)) == cmds[c].remote_id && p[3] == cmds[c].btn_id) {
+				cmds[c].acked = true;
+				cmds[c].t_ack = sim_us();
+			}
+		}
+	}
+
+	avr->data[tx_buffer + DLSIM_RING_TAIL(DLSIM_TX_SIZE)] = tail;
+}
+
+static pulse_class_t classify(double us) {
+	if (us < nominal[PULSE_ZERO] / 2)
+		return PULSE_GLITCH;
+	if (us < (nominal[PULSE_ZERO] + nominal[PULSE_ONE]) / 2)
+		return PULSE_ZERO;
+	if (us < (nominal[PULSE_ONE] + nominal[PULSE_START]) / 2)
+		return PULSE_ONE;
+	if (us < nominal[PULSE_START] * 2)
+		return PULSE_START;
+	return PULSE_LONG;
+}
+
+/// @brief Decodes recorded edges into bursts of frames, collecting pulse timing stats.
+/// @return Number of bursts decoded
+static int decode(burst_t* bursts, int max_bursts, stat_t* stats) {
+	int nbursts = 0;
+	burst_t* b = NULL;
+	bool in_frame = false, half_zero = false;
+	uint32_t bits = 0;
+	int nbits = 0;
+
+	for (size_t i = 1; i < edges.count; i++) {
+		double dur = edges.t[i] - edges.t[i - 1];
+		pulse_class_t cls = classify(dur);
+
+		if (dur > DLSIM_BURST_GAP_US || !b) {
+			if (nbursts == max_bursts)
+				break;
+			b = &bursts[nbursts++];
+			memset(b, 0, sizeof(*b));
+			b->t_first = edges.t[i];
+			in_frame = false;
+			if (dur > DLSIM_BURST_GAP_US)
+				continue;
+		}
+		b->t_last = edges.t[i];
+
+		if (cls == PULSE_START) {
+			// Start pulse is the high level period before the frame data
+			if (in_frame)
+				b->errors++; // Frame cut short
+			if (edges.level[i - 1] == 1) {
+				if (b->last_start > 0)
+					stat_add(&b->period, edges.t[i - 1] - b->last_start);
+				b->last_start = edges.t[i - 1];
+				stat_add(&stats[PULSE_START], dur - nominal[PULSE_START]);
+				in_frame = true;
+				half_zero = false;
+				bits = 0;
+				nbits = 0;
+			}
+			else
+				in_frame = false;
+			continue;
+		}
+
+		if (!in_frame)
+			continue; // Glitch after the frame end or noise
+
+		if (cls == PULSE_ZERO) {
+			stat_add(&stats[PULSE_ZERO], dur - nominal[PULSE_ZERO]);
+			if (half_zero) {
+				bits <<= 1;
+				nbits++;
+			}
+			half_zero = !half_zero;
+		}
+		else if (cls == PULSE_ONE && !half_zero) {
+			stat_add(&stats[PULSE_ONE], dur - nominal[PULSE_ONE]);
+			bits = (bits << 1) | 1;
+			nbits++;
+		}
+		else {
+			// Glitch or a lone half of the 0 bit inside the frame
+			b->errors++;
+			in_frame = false;
+			continue;
+		}
+
+		if (nbits == DLSIM_FRAME_BITS) {
+			uint16_t remote_id = (uint16_t)(bits >> 7);
+			uint8_t btn_id = bits & 0x7F;
+
+			if (!b->code_set) {
+				b->remote_id = remote_id;
+				b->btn_id = btn_id;
+				b->code_set = true;
+			}
+			else if (b->remote_id != remote_id || b->btn_id != btn_id)
+				b->mixed = true;
+
+			b->frames++;
+			in_frame = false;
+		}
+	}
+
+	return nbursts;
+}
+
+/// @brief Returns true if the next instruction is RETI.
+static bool profile_at_reti(void) {
+	return (avr->flash[avr->pc] | (avr->flash[avr->pc + 1] << 8)) == DLSIM_OP_RETI;
+}
+
+/// @brief Tracks ISR entries & exits after each instruction.
+/// @param reti[in] executed instruction was RETI
+static void profile_step(bool reti) {
+	if (reti && prof.depth > 0) {
+		prof.depth--;
+		avr_cycle_count_t total = avr->cycle - prof.stack[prof.depth].entry;
+		if (prof.active)
+			stat_add(&prof.isr[prof.stack[prof.depth].vector], (double)(total - prof.stack[prof.depth].nested));
+		if (prof.depth > 0)
+			prof.stack[prof.depth - 1].nested += total;
+	}
+
+	// Vector table is reached only by the interrupts, except for the reset
+	if (avr->pc == 0 || avr->pc >= DLSIM_VECTORS * 2 || (avr->pc & 1))
+		return;
+
+	int vector = avr->pc / 2;
+	if (prof.depth < DLSIM_ISR_NESTING) {
+		prof.stack[prof.depth].vector = vector;
+		prof.stack[prof.depth].entry = avr->cycle;
+		prof.stack[prof.depth].nested = 0;
+		prof.depth++;
+		if (prof.depth > prof.max_depth)
+			prof.max_depth = prof.depth;
+	}
+
+	if (vector == DLSIM_VEC_USB && prof.dplus_edge) {
+		stat_add(&prof.usb_latency, (double)(avr->cycle - prof.dplus_edge));
+		prof.dplus_edge = 0;
+	}
+}
+
+/// @brief simavr cycle timer, flips D+ at random intervals while RF burst are on air
+///        to trigger the USB ISR.
+static avr_cycle_count_t dplus_timer(avr_t* avr_, avr_cycle_count_t when, void* param) {
+	(void)avr_;
+	(void)param;
+
+	bool on_air = edges.count && sim_us() - edges.t[edges.count - 1] < 1000;
+	if (prof.active && on_air && !prof.dplus_edge) {
+		prof.dplus_level = !prof.dplus_level;
+		prof.dplus_edge = avr->cycle;
+		avr_raise_irq(prof.dplus, prof.dplus_level);
+	}
+
+	prof.rng = prof.rng * 1103515245 + 12345;
+	uint32_t us = DLSIM_DPLUS_MIN_US + (prof.rng >> 16) % (DLSIM_DPLUS_MAX_US - DLSIM_DPLUS_MIN_US);
+	return when + (avr_cycle_count_t)us * avr->frequency / 1000000;
+}
+
+/// @brief simavr IO write callback for GPIOR0, timestamps DL_PROFILE_MARK() writes.
+static void gpior_write(avr_t* avr_, avr_io_addr_t addr, uint8_t v, void* param) {
+	(void)param;
+	avr_->data[addr] = v;
+
+	if (v == DLSIM_MARK_USBPOLL) {
+		if (prof.active && prof.last_poll)
+			stat_add(&prof.poll_gap, (double)(avr_->cycle - prof.last_poll) * 1000000.0 / avr_->frequency);
+		prof.last_poll = avr_->cycle;
+	}
+}
+
+static void profile_init(void) {
+	prof.rng = 1;
+	prof.dplus = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(DLSIM_USB_PORT), DLSIM_USB_DPLUS_PIN);
+
+	// Idle low-speed bus (J state): D- high, D+ low
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(DLSIM_USB_PORT), DLSIM_USB_DMINUS_PIN), 1);
+	avr_raise_irq(prof.dplus, 0);
+
+	avr_register_io_write(avr, DLSIM_GPIOR0, gpior_write, NULL);
+	avr_cycle_timer_register(avr, avr->frequency / 1000, dplus_timer, NULL);
+}
+
+static void print_stat(const char* name, const stat_t* s, const char* unit) {
+	printf("  %-14s %8u %9.1f %9.1f %9.1f %s\n", name, s->count, s->count ? s->min : 0, stat_avg(s), s->count ? s->max : 0, unit);
+}
+
+static void print_profile(void) {
+	printf("\nISR profile, cycles excluding nested ISRs (max nesting %d):\n", prof.max_depth);
+	printf("  %-14s %8s %9s %9s %9s\n", "vector", "count", "min", "avg", "max");
+	for (int i = 1; i < DLSIM_VECTORS; i++)
+		if (prof.isr[i].count)
+			print_stat(vector_names[i], &prof.isr[i], "");
+
+	printf("\nUSB ISR entry latency from D+ edge during RF burst:\n");
+	print_stat("latency", &prof.usb_latency, "cycles");
+	printf("\nTime between usbPoll() calls%s:\n", prof.poll_gap.count ? "" : " (firmware built without DL_PROFILE)");
+	print_stat("usbPoll gap", &prof.poll_gap, "us");
+}
+
+static void json_stat(FILE* f, const char* name, const stat_t* s, bool last) {
+	fprintf(f, "\"%s\": {\"count\": %u, \"min\": %.2f, \"avg\": %.2f, \"max\": %.2f, \"stddev\": %.2f}%s", \
+		name, s->count, s->count ? s->min : 0, stat_avg(s), s->count ? s->max : 0, stat_stddev(s), last ? "" : ", ");
+}
+
+/// @brief Writes machine readable report.
+static bool write_json(const char* path, const char* elf_file, const sim_cmd_t* cmds, int ncmds, \
+	const burst_t* bursts, int nbursts, const stat_t* stats, bool ok) {
+	FILE* f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "{\n  \"firmware\": \"%s\",\n  \"pass\": %s,\n  \"commands\": [\n", elf_file, ok ? "true" : "false");
+	for (int c = 0; c < ncmds; c++) {
+		fprintf(f, "    {\"remote_id\": %u, \"key\": %u, \"acked\": %s, \"ack_ms\": %.3f", \
+			cmds[c].remote_id, cmds[c].btn_id, cmds[c].acked ? "true" : "false", cmds[c].acked ? (cmds[c].t_ack - cmds[c].t_sent) / 1000 : 0);
+		if (c < nbursts) {
+			const burst_t* b = &bursts[c];
+			fprintf(f, ", \"decoded_remote_id\": %u, \"decoded_key\": %u, \"frames\": %u, \"errors\": %u, \"burst_ms\": %.3f, ", \
+				b->remote_id, b->btn_id, b->frames, b->errors, (b->t_last - b->t_first) / 1000);
+			json_stat(f, "frame_period_us", &b->period, true);
+		}
+		fprintf(f, "}%s\n", c + 1 < ncmds ? "," : "");
+	}
+
+	fprintf(f, "  ],\n  \"pulse_error_us\": {");
+	for (int i = PULSE_ZERO; i <= PULSE_START; i++)
+		json_stat(f, pulse_names[i], &stats[i], i == PULSE_START);
+	fprintf(f, "}");
+
+	if (prof.enabled) {
+		fprintf(f, ",\n  \"isr_cycles\": {");
+		bool first = true;
+		for (int i = 1; i < DLSIM_VECTORS; i++) {
+			if (!prof.isr[i].count)
+				continue;
+			fprintf(f, "%s", first ? "" : ", ");
+			json_stat(f, vector_names[i], &prof.isr[i], true);
+			first = false;
+		}
+		fprintf(f, "},\n  \"isr_max_nesting\": %d,\n  ", prof.max_depth);
+		json_stat(f, "usb_latency_cycles", &prof.usb_latency, false);
+		fprintf(f, "\n  ");
+		json_stat(f, "usbpoll_gap_us", &prof.poll_gap, true);
+	}
+	fprintf(f, "\n}\n");
+
+	if (f != stdout)
+		fclose(f);
+	return true;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-p] [-j FILE.json] [-o FILE.vcd] [-t BOOT_MS] [-n START,ZERO,ONE] FIRMWARE.elf [REMOTE_ID KEY_CODE]...\n", name);
+	fprintf(stderr, "  -p        profile ISRs, USB ISR latency & usbPoll() gaps\n");
+	fprintf(stderr, "  -j FILE   write report as JSON, - for stdout\n");
+	fprintf(stderr, "  -o FILE   write TX pin waveform to a VCD file\n");
+	fprintf(stderr, "  -t MS     simulated time to let firmware boot before sending commands (default 500)\n");
+	fprintf(stderr, "  -n LIST   nominal start, zero & one pulse durations in us (default 500,100,300)\n");
+	fprintf(stderr, "Sends remote ID 6400 key code 0 if no commands are given.\n");
+}
+
+int main(int argc, char** argv) {
+	const char* vcd_file = NULL;
+	const char* json_file = NULL;
+	double boot_ms = 500;
+	sim_cmd_t cmds[DLSIM_MAX_CMDS];
+	int ncmds = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "pj:o:t:n:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			prof.enabled = true;
+			break;
+		case 'j':
+			json_file = optarg;
+			break;
+		case 'o':
+			vcd_file = optarg;
+			break;
+		case 't':
+			boot_ms = atof(optarg);
+			break;
+		case 'n':
+			if (sscanf(optarg, "%lf,%lf,%lf", &nominal[PULSE_START], &nominal[PULSE_ZERO], &nominal[PULSE_ONE]) != 3) {
+				usage(argv[0]);
+				return 2;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind >= argc || (argc - optind - 1) % 2 != 0 || (argc - optind - 1) / 2 > DLSIM_MAX_CMDS) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	const char* elf_file = argv[optind++];
+	for (; optind < argc; optind += 2, ncmds++) {
+		cmds[ncmds].remote_id = (uint16_t)strtoul(argv[optind], NULL, 0);
+		cmds[ncmds].btn_id = (uint8_t)strtoul(argv[optind + 1], NULL, 0) & 0x7F;
+	}
+	if (ncmds == 0) {
+		cmds[0].remote_id = 6400;
+		cmds[0].btn_id = 0;
+		ncmds = 1;
+	}
+	for (int c = 0; c < ncmds; c++) {
+		cmds[c].seq = (uint8_t)(c + 1);
+		cmds[c].acked = false;
+	}
+
+	uint32_t rx_buffer = elf_symbol(elf_file, "rx_buffer");
+	uint32_t tx_buffer = elf_symbol(elf_file, "tx_buffer");
+	if (!rx_buffer || !tx_buffer) {
+		fprintf(stderr, "ERROR: rx_buffer/tx_buffer symbols not found in %s\n", elf_file);
+		return 2;
+	}
+
+	elf_firmware_t fw;
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elf_file, &fw) != 0) {
+		fprintf(stderr, "ERROR: unable to read %s\n", elf_file);
+		return 2;
+	}
+	strcpy(fw.mmcu, DLSIM_MCU);
+	fw.frequency = DLSIM_FREQ;
+
+	avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr) {
+		fprintf(stderr, "ERROR: simavr doesn't support %s\n", fw.mmcu);
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+
+	avr_irq_t* tx_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(DLSIM_TX_PORT), DLSIM_TX_PIN);
+	avr_irq_register_notify(tx_irq, pin_changed, NULL);
+
+	if (prof.enabled)
+		profile_init();
+
+	avr_vcd_t vcd;
+	if (vcd_file) {
+		avr_vcd_init(avr, vcd_file, &vcd, 1 /* us */);
+		avr_vcd_add_signal(&vcd, tx_irq, 1, "PB5");
+		avr_vcd_start(&vcd);
+	}
+
+	// Button code airtime is ~1 s, give each command 3 s to be ACKed
+	double deadline = boot_ms * 1000 + ncmds * 3000000.0;
+	double next_check = 0;
+	bool injected = false;
+	int acked = 0;
+	int state = cpu_Running;
+
+	while (state != cpu_Done && state != cpu_Crashed && acked < ncmds && sim_us() < deadline) {
+		if (prof.enabled) {
+			bool reti = profile_at_reti();
+			state = avr_run(avr);
+			profile_step(reti);
+		}
+		else
+			state = avr_run(avr);
+
+		if (!injected && sim_us() >= boot_ms * 1000) {
+			for (int c = 0; c < ncmds; c++) {
+				if (!inject(rx_buffer, &cmds[c])) {
+					fprintf(stderr, "ERROR: rx_buffer full\n");
+					return 2;
+				}
+				cmds[c].t_sent = sim_us();
+			}
+			// Ignore edges before the commands, i.e. pin setup
+			edges.count = 0;
+			injected = true;
+			prof.active = true;
+		}
+
+		// Check for ACKs every 1 ms of simulated time
+		if (injected && sim_us() >= next_check) {
+			next_check = sim_us() + 1000;
+			check_acks(tx_buffer, cmds, ncmds);
+			acked = 0;
+			for (int c = 0; c < ncmds; c++)
+				acked += cmds[c].acked;
+		}
+	}
+
+	if (vcd_file)
+		avr_vcd_stop(&vcd);
+
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "ERROR: firmware crashed at %.1f ms\n", sim_us() / 1000);
+		return 1;
+	}
+
+	burst_t bursts[DLSIM_MAX_CMDS];
+	stat_t stats[PULSE_CLASSES];
+	memset(stats, 0, sizeof(stats));
+	int nbursts = decode(bursts, DLSIM_MAX_CMDS, stats);
+	bool ok = (nbursts == ncmds);
+
+	printf("Firmware: %s, %d command(s), %zu edges recorded\n\n", elf_file, ncmds, edges.count);
+
+	for (int c = 0; c < ncmds; c++) {
+		printf("Command %d: remote %u key %u, ", c + 1, cmds[c].remote_id, cmds[c].btn_id);
+		if (cmds[c].acked)
+			printf("ACK after %.1f ms\n", (cmds[c].t_ack - cmds[c].t_sent) / 1000);
+		else {
+			printf("no ACK\n");
+			ok = false;
+		}
+
+		if (c >= nbursts) {
+			printf("  No RF burst\n");
+			continue;
+		}
+
+		burst_t* b = &bursts[c];
+		bool match = b->code_set && !b->mixed && b->remote_id == cmds[c].remote_id && b->btn_id == cmds[c].btn_id;
+		printf("  Decoded: remote %u key %u%s - %s\n", b->remote_id, b->btn_id, b->mixed ? " (mixed codes)" : "", match ? "OK" : "MISMATCH");
+		printf("  Frames: %u (expected %d), errors: %u\n", b->frames, DLSIM_FRAMES, b->errors);
+		printf("  Burst duration: %.3f ms, frame period avg %.1f us, min %.1f us, max %.1f us, jitter (stddev) %.2f us\n", \
+			(b->t_last - b->t_first) / 1000, stat_avg(&b->period), b->period.min, b->period.max, stat_stddev(&b->period));
+		if (!match || b->frames != DLSIM_FRAMES || b->errors)
+			ok = false;
+	}
+
+	printf("\nPulse timing error against nominals:\n");
+	printf("  %-6s %8s %8s %9s %9s %9s %9s\n", "pulse", "nominal", "count", "avg", "min", "max", "stddev");
+	for (int i = PULSE_ZERO; i <= PULSE_START; i++)
+		printf("  %-6s %6.0fus %8u %+7.2fus %+7.2fus %+7.2fus %7.2fus\n", pulse_names[i], nominal[i], stats[i].count, \
+			stat_avg(&stats[i]), stats[i].min, stats[i].max, stat_stddev(&stats[i]));
+
+	if (prof.enabled)
+		print_profile();
+
+	if (json_file && !write_json(json_file, elf_file, cmds, ncmds, bursts, nbursts, stats, ok)) {
+		fprintf(stderr, "Can't write %s\n", json_file);
+		return 2;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* libdigilivolo: DigiLivolo device control library.
+ *
+ * Device is opened once & commands are submitted without blocking. They're sent as the device
+ * queue allows & completed from digilivolo_process(), which calls the callback of every
+ * completed command. Event loop may wait on digilivolo_get_fd() (if the transport has one)
+ * for up to digilivolo_get_timeout() milliseconds before calling digilivolo_process().
+ *
+ * Handles aren't thread safe, use each one from a single thread. Structures passed in are
+ * only read during the call. ABI is stable within DIGILIVOLO_ABI_VERSION, new functions may
+ * be added. */
+
+#ifndef __digilivolo_h__
+#define __digilivolo_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremented on incompatible changes, as the shared library SOVERSION
+#define DIGILIVOLO_ABI_VERSION 1
+
+#if defined(_WIN32) && defined(DIGILIVOLO_SHARED)
+#ifdef DIGILIVOLO_BUILD
+#define DIGILIVOLO_EXPORT __declspec(dllexport)
+#else
+#define DIGILIVOLO_EXPORT __declspec(dllimport)
+#endif
+#elif defined(__GNUC__) && defined(DIGILIVOLO_BUILD)
+#define DIGILIVOLO_EXPORT __attribute__((visibility("default")))
+#else
+#define DIGILIVOLO_EXPORT
+#endif
+
+// Result codes, negative are errors
+#define DIGILIVOLO_OK 0
+#define DIGILIVOLO_ERR_SEND -1 // Unable to send a command to the device
+#define DIGILIVOLO_ERR_REPLY -2 // Device replied with a wrong ACK
+#define DIGILIVOLO_ERR_TIMEOUT -3 // No ACK from the device before the deadline
+#define DIGILIVOLO_ERR_STATUS -4 // Device replied with an error status
+#define DIGILIVOLO_ERR_ARG -5 // Invalid argument
+#define DIGILIVOLO_ERR_NOMEM -6 // Out of memory
+#define DIGILIVOLO_ERR_CANCELLED -7 // Handle was closed before the command completed
+
+// digilivolo_open() flags
+#define DIGILIVOLO_OPEN_VERBOSE 0x01 // Print diagnostic messages, errors & warnings to stdout, nothing without it
+
+// digilivolo_cmd_t flags
+#define DIGILIVOLO_CMD_OLD 0x01 // Use the old transmit algorithm (firmware 2.00+)
+
+typedef struct digilivolo digilivolo_t;
+
+/// @brief Switch command.
+typedef struct digilivolo_cmd {
+	uint16_t remote_id; // Livolo remote ID, 1-65535
+	uint8_t key_code; // Livolo key code, 1-255
+	uint8_t repeats; // Frame repeats after the first one, 0 - device default
+	uint8_t flags; // DIGILIVOLO_CMD_* flags
+	uint8_t reserved[3]; // Set to 0
+} digilivolo_cmd_t;
+
+/// @brief Command result, passed to the completion callback.
+typedef struct digilivolo_result {
+	uint32_t id; // Command ID returned by digilivolo_submit()
+	int status; // DIGILIVOLO_OK or DIGILIVOLO_ERR_* code
+	uint16_t remote_id;
+	uint8_t key_code;
+	uint8_t reserved;
+	uint32_t latency_us; // From sending the command to its ACK
+} digilivolo_result_t;
+
+/// @brief Completion callback. May submit new commands, but not close the handle.
+typedef void (*digilivolo_cb_t)(digilivolo_t* dl, const digilivolo_result_t* result, void* user_data);
+
+/// @brief Returns library version string.
+DIGILIVOLO_EXPORT const char* digilivolo_version(void);
+
+/// @brief Opens DigiLivolo device.
+/// @param transport[in] "NAME[:ARGS]" transport spec as the digilivolo -t option, NULL for the default
+/// @param flags[in] DIGILIVOLO_OPEN_* flags
+/// @return handle or NULL if the device can't be opened
+DIGILIVOLO_EXPORT digilivolo_t* digilivolo_open(const char* transport, unsigned int flags);
+
+/// @brief Closes the device. Pending commands are completed with DIGILIVOLO_ERR_CANCELLED.
+DIGILIVOLO_EXPORT void digilivolo_close(digilivolo_t* dl);
+
+/// @brief Returns firmware version of the device, i.e. 0x0300 for 3.00.
+DIGILIVOLO_EXPORT unsigned int digilivolo_fw_version(const digilivolo_t* dl);
+
+/// @brief Queues a command & sends it if the device can take it. Doesn't wait for the ACK.
+/// @param cb[in] completion callback, NULL if not needed
+/// @return command ID (> 0) or DIGILIVOLO_ERR_* code
+DIGILIVOLO_EXPORT long digilivolo_submit(digilivolo_t* dl, const digilivolo_cmd_t* cmd, digilivolo_cb_t cb, void* user_data);
+
+/// @brief Queues several commands at once, they're packed into multi command reports where the
+///        firmware supports it. Each one gets own ID & callback call.
+/// @return ID of the first command, the rest are consecutive, or DIGILIVOLO_ERR_* code
+DIGILIVOLO_EXPORT long digilivolo_submit_batch(digilivolo_t* dl, const digilivolo_cmd_t* cmds, size_t count, digilivolo_cb_t cb, void* user_data);
+
+/// @brief Sends queued commands, reads the device replies & calls the callbacks of completed
+///        commands. Waits up to timeout_ms for a reply if commands are in flight.
+/// @param timeout_ms[in] milliseconds to wait, 0 to return at once
+/// @return number of commands completed or DIGILIVOLO_ERR_ARG
+DIGILIVOLO_EXPORT int digilivolo_process(digilivolo_t* dl, int timeout_ms);
+
+/// @brief Calls digilivolo_process() until all the commands are completed.
+/// @return number of failed commands or DIGILIVOLO_ERR_ARG
+DIGILIVOLO_EXPORT int digilivolo_wait(digilivolo_t* dl);
+
+/// @brief Returns number of submitted commands which aren't completed yet.
+DIGILIVOLO_EXPORT size_t digilivolo_pending(const digilivolo_t* dl);
+
+/// @brief Returns file descriptor which becomes readable when the device replies, to wait on
+///        with poll/epoll/select. Only some transports have it, i.e. hidraw.
+/// @return file descriptor or -1, then digilivolo_process() has to be called on timeout only
+DIGILIVOLO_EXPORT int digilivolo_get_fd(const digilivolo_t* dl);
+
+/// @brief Returns how soon digilivolo_process() should be called, even if nothing arrived.
+/// @return milliseconds or -1 if there are no commands pending
+DIGILIVOLO_EXPORT int digilivolo_get_timeout(const digilivolo_t* dl);
+
+/// @brief Sends one command & waits for its ACK, as the digilivolo CLI does.
+/// @param latency_us[out] time from sending the command to its ACK, may be NULL
+/// @return DIGILIVOLO_OK or DIGILIVOLO_ERR_* code
+DIGILIVOLO_EXPORT int digilivolo_switch(digilivolo_t* dl, uint16_t remote_id, uint8_t key_code, uint32_t* latency_us);
+
+/// @brief Returns description of DIGILIVOLO_OK or DIGILIVOLO_ERR_* code.
+DIGILIVOLO_EXPORT const char* digilivolo_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __digilivolo_h__
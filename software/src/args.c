@@ -40,7 +40,11 @@ const char* argp_program_bug_address = "https://github.com/N-Storm/DigiLivolo/\n
 Copyright (c) 2024 GitHub user N-Storm.\n\
 License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>";
 
-char args_doc[] = "REMOTE_ID KEY_CODE\n\
+char args_doc[] = "REMOTE_ID KEY_CODE [REMOTE_ID KEY_CODE...]\n\
+-b FILE\n\
+-S ID or -U FILE\n\
+-T[START,BIT,HALF,REPEATS,GAP]\n\
+--stats\n\
 -l or --list";
 
 struct argp_option options[] = {
@@ -48,8 +52,19 @@ struct argp_option options[] = {
   {"REMOTE_ID",   0,   0, OPTION_DOC | OPTION_NO_USAGE, "Livilo Remote ID (1-65535)"                  },
   {"KEY_CODE",    0,   0, OPTION_DOC | OPTION_NO_USAGE, "Livilo Key ID (1-255)"                       },
   {0,             0,   0,                            0, "Options:"                                    },
+  {"batch",     'b', "FILE",                         0, "Read \"REMOTE_ID KEY_CODE [REPEATS] [old]\" lines from FILE (\"-\" for stdin) and send them all over one device handle" },
   {"list",      'l',   0,                            0, "List USB devices"                            },
+  {"latency",   'L',   0,                            0, "Print device queue, air & USB/host time of each command, sent one per report" },
+  {"scene",     'S', "ID",                           0, "Play scene ID (0-254) stored in the device before sending the commands" },
+  {"upload-scenes", 'U', "FILE",                     0, "Build scene table from FILE and write it to the device EEPROM, replacing stored scenes" },
   {"old-alg",   'o',   0,                            0, "Use deperecated original transmit algorithm" },
+  {"repeats",   'r', "N",                            0, "Repeat each code N times (1-255) after the first frame, less to free the device sooner (default: device RF timing profile, 128)" },
+#ifndef _WIN32
+  {"socket",    's', "PATH",         OPTION_ARG_OPTIONAL, "Send command via digilivolod daemon listening on PATH (default: " DL_IPC_SOCKET_PATH ")" },
+#endif
+  {"stats",     OPT_STATS, 0,                        0, "Print device counters after the commands" },
+  {"transport", 't', "SPEC",                         0, "Talk to the device via transport set as NAME[:ARGS]: hidapi (default, ARGS - device path), hidraw (Linux, ARGS - device path), libusb (ARGS - BUS:ADDRESS) or emu (built-in device emulator, ARGS - speed-up factor)" },
+  {"timing",    'T', "PROFILE",          OPTION_ARG_OPTIONAL, "Show RF timing profile or set it as START,BIT,HALF,REPEATS,GAP: start pulse, 1 bit & half of 0 bit in us, frame repeats, pause between codes in ms (\"default\" restores defaults)" },
   {"verbose",   'v',   0,                            0, "Produce verbose output"                      },
   { 0 }
 };
@@ -61,6 +76,8 @@ error_t parse_opt(int key, char* arg, struct argp_state* state)
 	/* Get the input argument from argp_parse, which we
 	 * know is a pointer to our arguments structure. */
 	struct arguments* arguments = state->input;
+	char* endptr;
+	long value;
 
 	switch (key) {
 	case 'o':
@@ -72,36 +89,63 @@ error_t parse_opt(int key, char* arg, struct argp_state* state)
 	case 'l':
 		arguments->list_devices = true;
 		break;
+	case 'L':
+		arguments->latency = true;
+		break;
+	case 'b':
+		arguments->batch_file = arg;
+		break;
+	case 'S':
+		value = strtol(arg, &endptr, 0);
+		if (*endptr != '\0' || value < 0 || value >= DL_SCENE_END)
+			argp_error(state, "scene ID should be 0-254");
+		arguments->scene_id = (int)value;
+		break;
+	case 'U':
+		arguments->scenes_file = arg;
+		break;
+	case 'r':
+		value = strtol(arg, &endptr, 0);
+		if (*endptr != '\0' || value < 1 || value > 255)
+			argp_error(state, "repeats should be 1-255");
+		arguments->repeats = (uint8_t)value;
+		break;
+	case 'T':
+		arguments->timing = arg ? arg : "";
+		break;
+	case 't':
+		if (!dl_transport_valid(arg))
+			argp_error(state, "unknown transport %s", arg);
+		arguments->transport = arg;
+		break;
+	case OPT_STATS:
+		arguments->stats = true;
+		break;
+#ifndef _WIN32
+	case 's':
+		arguments->socket_path = arg ? arg : DL_IPC_SOCKET_PATH;
+		break;
+#endif
 
 	case ARGP_KEY_ARG:
-		if (state->arg_num >= 2)
-			// Too many arguments.
-			argp_usage(state);
-
-		char* endptr;
 		// Convert argument to long
-		long value = strtol(arg, &endptr, 0);
+		value = strtol(arg, &endptr, 0);
 		// Check if it was valid long value
 		if (*endptr == '\0') {
-			switch (state->arg_num) {
-			case 0:
+			// Arguments are REMOTE_ID KEY_CODE pairs
+			if (state->arg_num % 2 == 0) {
 				// Out of range
 				if (value > 65535 || value <= 0)
 					argp_usage(state);
-				else
-					arguments->remote_id = (uint16_t)value;
-				break;
-
-			case 1:
+				else if (dl_batch_add(&arguments->cmds, (uint16_t)value, 0, 0, false) < 0)
+					argp_failure(state, 1, 0, "out of memory");
+			}
+			else {
 				// Out of range
 				if (value > 255 || value <= 0)
 					argp_usage(state);
 				else
-					arguments->btn_id = (uint8_t)value;
-				break;
-
-			default:
-				return ARGP_ERR_UNKNOWN;
+					arguments->cmds.cmds[arguments->cmds.count - 1].btn_id = (uint8_t)value;
 			}
 		}
 		else
@@ -111,7 +155,8 @@ error_t parse_opt(int key, char* arg, struct argp_state* state)
 		break;
 
 	case ARGP_KEY_END:
-		if (state->arg_num < 2 && !arguments->list_devices)
+		if (!arguments->list_devices && (state->arg_num % 2 != 0 || (state->arg_num == 0 && !arguments->batch_file && \
+			!arguments->scenes_file && arguments->scene_id < 0 && !arguments->timing && !arguments->stats)))
 			// Not enough arguments.
 			argp_usage(state);
 		break;
@@ -24,12 +24,21 @@
 #include "git_version.h"
 #include <argp.h>
 
+#include "batch.h"
+
+#ifndef _WIN32
+#include "ipc.h"
+#endif
+
 /// @brief String definition with program name & version number
 #define PROG_NAME_VERSION "digilivolo " GIT_VERSION "\n"
 
 /// @brief [argp] A description of the command line arguments we accept.
 extern char args_doc[];
 
+/// @brief [argp] Keys of the long only options.
+#define OPT_STATS 0x100
+
 /// @brief [argp] Command line options we understand.
 extern struct argp_option options[];
 
@@ -41,9 +50,16 @@ extern const char* argp_program_bug_address;
 
 /// @brief [argp] Command-line arguments.
 typedef struct arguments {
-    uint16_t remote_id;
-    uint8_t btn_id;
-    bool verbose, old_alg, list_devices;
+    dl_batch_t cmds; // REMOTE_ID KEY_CODE pairs from the command line & batch file
+    const char* batch_file; // Read commands from this file ("-" for stdin) if not NULL
+    const char* scenes_file; // Upload scene table built from this file if not NULL
+    int scene_id; // Play this scene before the commands, -1 if none
+    const char* timing; // Show (empty string) or set RF timing profile if not NULL
+    uint8_t repeats; // Frame repeats for commands without their own count, 0 - device default
+    bool verbose, old_alg, list_devices, stats;
+    bool latency; // Print latency breakdown of each command from the device timings
+    const char* socket_path; // Send command via digilivolod if not NULL
+    const char* transport; // Device transport spec "NAME[:ARGS]", NULL for the default one
 } arguments_t;
 
 extern arguments_t arguments;
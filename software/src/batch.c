@@ -0,0 +1,341 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "defs.h"
+#include "dl_time.h"
+
+#include <hidapi.h>
+#include "transport.h"
+#include "usb_func.h"
+#include "batch.h"
+
+/// @brief Parses unsigned number in range [1, max] from the string.
+/// @param str[in,out] pointer to the parsing position, advanced past the number on success
+/// @param max[in] maximum allowed value
+/// @param value[out] parsed value
+/// @return true if a valid whitespace terminated number in range was found
+static bool parse_num(const char** str, long max, long* value)
+{
+	char* endptr;
+
+	*value = strtol(*str, &endptr, 0);
+	if (endptr == *str || (*endptr != '\0' && !isspace((unsigned char)*endptr)))
+		return false;
+
+	*str = endptr;
+	return (*value > 0 && *value <= max);
+}
+
+/// @brief Skips whitespace characters.
+static const char* skip_spaces(const char* str)
+{
+	while (isspace((unsigned char)*str))
+		str++;
+	return str;
+}
+
+bool dl_parse_cmd(const char* line, uint16_t* remote_id, uint8_t* btn_id, uint8_t* repeats, bool* use_old_alg)
+{
+	const char* p = skip_spaces(line);
+	long value;
+
+	if (!parse_num(&p, 65535, &value))
+		return false;
+	*remote_id = (uint16_t)value;
+
+	p = skip_spaces(p);
+	if (!parse_num(&p, 255, &value))
+		return false;
+	*btn_id = (uint8_t)value;
+
+	*repeats = 0;
+	p = skip_spaces(p);
+	if (isdigit((unsigned char)*p)) {
+		if (!parse_num(&p, 255, &value))
+			return false;
+		*repeats = (uint8_t)value;
+	}
+
+	*use_old_alg = false;
+	p = skip_spaces(p);
+	if (strncmp(p, "old", 3) == 0 && (p[3] == '\0' || isspace((unsigned char)p[3]))) {
+		*use_old_alg = true;
+		p = skip_spaces(p + 3);
+	}
+
+	// Nothing else is allowed on the line
+	return (*p == '\0');
+}
+
+error_t dl_batch_add(dl_batch_t* batch, uint16_t remote_id, uint8_t btn_id, uint8_t repeats, bool use_old_alg)
+{
+	if (batch->count == batch->size) {
+		size_t size = batch->size ? batch->size * 2 : 16;
+		dl_cmd_t* cmds = realloc(batch->cmds, size * sizeof(dl_cmd_t));
+		if (!cmds)
+			return -1;
+		batch->cmds = cmds;
+		batch->size = size;
+	}
+
+	dl_cmd_t* cmd = &batch->cmds[batch->count++];
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->remote_id = remote_id;
+	cmd->btn_id = btn_id;
+	cmd->repeats = repeats;
+	cmd->old_alg = use_old_alg;
+
+	return 0;
+}
+
+error_t dl_batch_load(dl_batch_t* batch, FILE* stream, uint8_t repeats, bool use_old_alg)
+{
+	char line[256];
+	int line_num = 0;
+	uint16_t remote_id;
+	uint8_t btn_id, line_repeats;
+	bool old_alg;
+
+	while (fgets(line, sizeof(line), stream)) {
+		line_num++;
+
+		// Line didn't fit into the buffer
+		if (!strchr(line, '\n') && !feof(stream))
+			return line_num;
+
+		const char* p = skip_spaces(line);
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (!dl_parse_cmd(p, &remote_id, &btn_id, &line_repeats, &old_alg))
+			return line_num;
+
+		if (dl_batch_add(batch, remote_id, btn_id, line_repeats ? line_repeats : repeats, old_alg || use_old_alg) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/// @brief Marks command as completed with a status.
+static void complete(dl_cmd_t* cmd, error_t status)
+{
+	cmd->status = status;
+	cmd->t_done = dl_time_us();
+	dl_batch_print_result(cmd);
+}
+
+/// @brief Waits for the device timings of the completed command & prints them.
+static void get_times(dl_cmd_t* cmd, dl_device_t* handle, bool verbose)
+{
+	dlusb_times_packet_t times;
+
+	if (dlusb_wait_times(&times, cmd->seq, handle, verbose) != DLUSB_OK) {
+		if (verbose)
+			printf("WARN: No timings from device for seq %u.\n", cmd->seq);
+		return;
+	}
+
+	cmd->timed = true;
+	cmd->queue_ms = times.queue_ms;
+	cmd->air_ms = times.air_ms;
+	dl_batch_print_times(cmd);
+}
+
+error_t dl_batch_send_group(dl_cmd_t* cmds, size_t count, dl_device_t* handle)
+{
+	dl_tuple_t tuples[DL_MULTI_MAX];
+	uint8_t seq = dlusb_next_seq();
+	uint64_t now = dl_time_us();
+
+	for (size_t i = 0; i < count; i++) {
+		cmds[i].seq = seq;
+		cmds[i].t_sent = now;
+		tuples[i].remote_id = cmds[i].remote_id;
+		tuples[i].btn_id = cmds[i].btn_id;
+		tuples[i].flags = cmds[i].old_alg ? DL_TUPLE_FLAG_OLD : 0;
+	}
+
+	if (count == 1)
+		return dlusb_send(cmds->remote_id, cmds->btn_id, cmds->old_alg, cmds->repeats, seq, handle);
+	else
+		return dlusb_send_multi(tuples, (uint8_t)count, cmds->repeats, seq, handle);
+}
+
+size_t dl_batch_group_size(const dl_batch_t* batch, size_t first, size_t end)
+{
+	size_t last = first + 1;
+
+	while (last < end && batch->cmds[last].seq == batch->cmds[first].seq)
+		last++;
+	return last - first;
+}
+
+size_t dl_batch_run(dl_batch_t* batch, dl_device_t* handle, bool verbose)
+{
+	dlusb_packet_t packet;
+	dlusb_status_packet_t status;
+	size_t head = 0; // Oldest command in flight
+	size_t next = 0; // Next command to send
+	size_t failed = 0;
+	size_t credits = 0; // Commands device queue can take, known from the status report
+	bool flow = dlusb_has_status(handle);
+	int res;
+
+	while (head < batch->count) {
+		/* Keep device queue filled. With the status report it's kept exactly full,
+		 * otherwise up to the window size. */
+		while (next < batch->count && (flow || next - head < DL_BATCH_WINDOW)) {
+			if (flow && credits == 0 && dlusb_get_status(&status, handle) >= 0)
+				credits = status.rx_free;
+
+			// Device queue is full, wait for some ACKs. Nothing in flight - try anyway.
+			if (flow && credits == 0 && next > head)
+				break;
+
+			size_t limit = flow ? (credits ? credits : 1) : DL_BATCH_WINDOW - (next - head);
+
+			// Several commands go in one report if the device supports it, repeats are set per report
+			size_t count = 1;
+			if (dlusb_has_multi(handle) && !dlusb_times_requested(handle)) {
+				while (count < DL_MULTI_MAX && count < limit && next + count < batch->count && \
+					batch->cmds[next + count].repeats == batch->cmds[next].repeats)
+					count++;
+			}
+
+			if (dl_batch_send_group(&batch->cmds[next], count, handle) < 0) {
+				// Device queue is probably full, wait for some ACKs before retrying.
+				if (next > head)
+					break;
+
+				// Nothing in flight, so it's a real error
+				for (size_t i = 0; i < count; i++) {
+					failed++;
+					complete(&batch->cmds[head++], DLUSB_ERR_SEND);
+				}
+				next = head;
+				continue;
+			}
+			next += count;
+			credits = (credits > count) ? credits - count : 0;
+		}
+
+		if (head == next)
+			continue;
+
+		// Device ACKs a group once, after all of its commands were transmitted
+		size_t head_count = dl_batch_group_size(batch, head, next);
+		uint32_t timeout_ms = DLUSB_ACK_TIMEOUT_MS + (uint32_t)(head_count - 1) * DLUSB_TX_DURATION_MS;
+
+		res = dlusb_wait_packet(&packet, handle, timeout_ms);
+		if (res == DLUSB_ERR_TIMEOUT) {
+			if (verbose)
+				printf("WARN: No ACK from device after %u ms, %zu commands in flight.\n", timeout_ms, next - head);
+			while (head < next) {
+				failed++;
+				complete(&batch->cmds[head++], DLUSB_ERR_TIMEOUT);
+			}
+			continue;
+		}
+
+		/* Tagged replies are matched by seq number. Untagged ones from the older firmware
+		 * by content. Replies arrive in order, so commands before the matching one have
+		 * been lost. Stale reports & RDY packet don't match anything and are skipped. */
+		size_t match;
+		for (match = head; match < next; match++) {
+			dl_cmd_t* cmd = &batch->cmds[match];
+			if (packet.seq != 0 ? packet.seq == cmd->seq : dlusb_is_ack(&packet, cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->seq))
+				break;
+		}
+
+		if (match == next) {
+			if (verbose)
+				printf("Skipping stale report from device (CMD ID 0x%02x, seq %u).\n", packet.cmd_id, packet.seq);
+			continue;
+		}
+
+		while (head < match) {
+			failed++;
+			complete(&batch->cmds[head++], DLUSB_ERR_REPLY);
+		}
+
+		size_t count = dl_batch_group_size(batch, head, next);
+		bool ok;
+		if (count > 1)
+			ok = dlusb_is_multi_ack(&packet, batch->cmds[head].seq);
+		else {
+			dl_cmd_t* cmd = &batch->cmds[head];
+			ok = dlusb_is_ack(&packet, cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->seq);
+		}
+
+		// Device timings follow the ACK of the single command
+		if (ok && count == 1 && dlusb_times_requested(handle)) {
+			complete(&batch->cmds[head], DLUSB_OK);
+			get_times(&batch->cmds[head++], handle, verbose);
+			continue;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (ok)
+				complete(&batch->cmds[head++], DLUSB_OK);
+			else {
+				failed++;
+				complete(&batch->cmds[head++], packet.status != DL_STATUS_OK ? DLUSB_ERR_STATUS : DLUSB_ERR_REPLY);
+			}
+		}
+	}
+
+	return failed;
+}
+
+void dl_batch_print_result(const dl_cmd_t* cmd)
+{
+	printf("%u %u", cmd->remote_id, cmd->btn_id);
+	if (cmd->repeats)
+		printf(" %u", cmd->repeats);
+	printf("%s: %s%s, %.1f ms\n", cmd->old_alg ? " old" : "", \
+		cmd->status == DLUSB_OK ? "" : "ERROR ", dlusb_strerror(cmd->status), (cmd->t_done - cmd->t_sent) / 1000.0);
+	fflush(stdout);
+}
+
+void dl_batch_print_times(const dl_cmd_t* cmd)
+{
+	double total_ms = (cmd->t_done - cmd->t_sent) / 1000.0;
+	double usb_ms = total_ms - cmd->queue_ms - cmd->air_ms;
+
+	// Device clock & ms rounding can make it slightly negative for the fast replies
+	printf("  device queue %u ms, air %u ms, USB & host %.1f ms\n", cmd->queue_ms, cmd->air_ms, usb_ms > 0 ? usb_ms : 0.0);
+	fflush(stdout);
+}
+
+void dl_batch_free(dl_batch_t* batch)
+{
+	free(batch->cmds);
+	batch->cmds = NULL;
+	batch->count = batch->size = 0;
+}
@@ -0,0 +1,119 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __batch_h__
+#define __batch_h__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "transport.h"
+
+#ifndef __error_t_defined
+typedef int error_t;
+#define __error_t_defined
+#endif
+
+/* How many commands are kept in flight with firmware which has no status report.
+ * Device rx_buffer ring holds 15 packets on firmware before v3.00, plus the one
+ * being transmitted. Newer firmware reports free space in its queue. */
+#define DL_BATCH_WINDOW 15
+
+/// @brief One switch command with its result.
+typedef struct dl_cmd {
+    uint16_t remote_id;
+    uint8_t btn_id;
+    uint8_t repeats; // Frame repeats after the first one, 0 - device default
+    bool old_alg;
+    uint8_t seq; // Sequence number the command was sent with
+    error_t status; // DLUSB_OK or DLUSB_ERR_* code once completed
+    uint64_t t_sent; // dl_time_us() timestamps
+    uint64_t t_done;
+    bool timed; // Device reported timings below (dlusb_times_packet_t)
+    uint16_t queue_ms; // Device queue, from the command taken from USB to its transmit start
+    uint16_t air_ms; // Transmit time
+} dl_cmd_t;
+
+/// @brief Growing list of commands.
+typedef struct dl_batch {
+    dl_cmd_t* cmds;
+    size_t count;
+    size_t size;
+} dl_batch_t;
+
+/// @brief Parses a command line in "REMOTE_ID KEY_CODE [REPEATS] [old]" format.
+///        Numbers may be decimal or hex (0x prefixed), as on the command line.
+/// @param line[in] zero terminated string to parse
+/// @param remote_id[out] parsed Livolo Remote ID
+/// @param btn_id[out] parsed Livolo Keycode
+/// @param repeats[out] parsed frame repeats (1-255) or 0 if not present
+/// @param use_old_alg[out] set to true if optional "old" keyword was present
+/// @return true if line was parsed successfully, false otherwise
+extern bool dl_parse_cmd(const char* line, uint16_t* remote_id, uint8_t* btn_id, uint8_t* repeats, bool* use_old_alg);
+
+/// @brief Appends a command to the batch.
+/// @return 0 on success, -1 on memory allocation failure
+extern error_t dl_batch_add(dl_batch_t* batch, uint16_t remote_id, uint8_t btn_id, uint8_t repeats, bool use_old_alg);
+
+/// @brief Reads commands from a stream, one "REMOTE_ID KEY_CODE [REPEATS] [old]" per line.
+///        Empty lines and lines starting with '#' are ignored.
+/// @param batch[in,out] batch to append commands to
+/// @param stream[in] stream to read from
+/// @param repeats[in] default frame repeats for lines without REPEATS, 0 - device default
+/// @param use_old_alg[in] default transmit method for lines without "old" keyword
+/// @return 0 on success, line number of the first malformed line or -1 on memory allocation failure
+extern error_t dl_batch_load(dl_batch_t* batch, FILE* stream, uint8_t repeats, bool use_old_alg);
+
+/// @brief Sends all commands over one open device, keeping device queue full (as reported
+///        by the device status report) or up to DL_BATCH_WINDOW commands queued on the older
+///        firmware, and collects ACKs. Only commands with the same repeats share a multi command report.
+///        If the device timings are requested (dlusb_request_times), commands are sent one per report
+///        & their CMD_TIMES reports are collected after the ACKs.
+/// @param batch[in,out] commands to run, status & timestamps are updated
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @return number of failed commands
+extern size_t dl_batch_run(dl_batch_t* batch, dl_device_t* handle, bool verbose);
+
+/// @brief Sends a group of commands, in one REPORT_ID_MULTI report if there are several of them.
+///        All commands of the group are tagged with the same seq & have the same repeats.
+/// @param cmds[in,out] commands to send, seq & send time are set
+/// @param count[in] number of commands, up to DL_MULTI_MAX
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Passes return code from dlusb_send() or dlusb_send_multi()
+extern error_t dl_batch_send_group(dl_cmd_t* cmds, size_t count, dl_device_t* handle);
+
+/// @brief Returns number of commands starting from first which were sent in one group.
+/// @param end[in] index past the last command sent
+extern size_t dl_batch_group_size(const dl_batch_t* batch, size_t first, size_t end);
+
+/// @brief Prints one result line for a command.
+/// @param cmd[in] completed command
+extern void dl_batch_print_result(const dl_cmd_t* cmd);
+
+/// @brief Prints latency breakdown of the command with the device timings: device queue,
+///        airtime & the rest of the time from send to ACK, i.e. USB transfers & host polling.
+/// @param cmd[in] completed command
+extern void dl_batch_print_times(const dl_cmd_t* cmd);
+
+/// @brief Frees memory used by the batch.
+extern void dl_batch_free(dl_batch_t* batch);
+
+#endif // __batch_h__
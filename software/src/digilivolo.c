@@ -25,39 +25,280 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#ifdef _WIN32
-#include <windows.h>
-#define dl_sleep_ms(ms) Sleep(ms)
-#else
+#ifndef _WIN32
+#include <errno.h>
 #include <unistd.h>
-#define dl_sleep_ms(ms) usleep(ms * 1000)
 #endif
 
 #include "defs.h"
 #include "args.h"
 
 #include <hidapi.h>
+#include "transport.h"
 #include "usb_func.h"
-
-#if defined(__APPLE__) && HID_API_VERSION >= HID_API_MAKE_VERSION(0, 12, 0)
-#include <hidapi_darwin.h>
-#endif
+#include "dl_time.h"
+#include "scene.h"
 
 // [argp] Our argp parser.
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
+// Scene table loaded from the -U file
+static dl_scenes_t scenes;
+
+#ifndef _WIN32
+/// @brief Sends commands via digilivolod daemon instead of opening the device directly.
+/// @return program exit code
+static int run_client(void)
+{
+	char reply[DL_IPC_LINE_MAX];
+	size_t failed = 0;
+	int fd, res;
+
+	fd = dl_ipc_connect(arguments.socket_path);
+	if (fd < 0) {
+		printf("ERROR: unable to connect to digilivolod at %s: %s\n", arguments.socket_path, strerror(errno));
+		return 1;
+	}
+
+	for (size_t i = 0; i < arguments.cmds.count; i++) {
+		dl_cmd_t* cmd = &arguments.cmds.cmds[i];
+
+		cmd->t_sent = dl_time_us();
+		res = dl_ipc_request(fd, cmd->remote_id, cmd->btn_id, cmd->repeats, cmd->old_alg, reply, sizeof(reply));
+		cmd->t_done = dl_time_us();
+
+		if (res < 0) {
+			printf("ERROR: no reply from digilivolod\n");
+			close(fd);
+			return 1;
+		}
+		else if (res > 0) {
+			printf("ERROR: digilivolod: %s\n", reply);
+			failed++;
+		}
+		else if (arguments.verbose)
+			printf("digilivolod: %s\n", reply);
+
+		if (arguments.cmds.count > 1) {
+			cmd->status = (res == 0) ? DLUSB_OK : DLUSB_ERR_REPLY;
+			dl_batch_print_result(cmd);
+		}
+	}
+	close(fd);
+
+	if (failed)
+		return 1;
+
+	if (arguments.cmds.count == 1)
+		printf("Device acks codes correctly.\n");
+
+	return 0;
+}
+#endif
+
+/// @brief Sends one command & waits for the ACK, printing progress messages.
+/// @return program exit code
+static int run_single(dl_cmd_t* cmd, dl_device_t* handle)
+{
+	uint32_t latency_us;
+	int res;
+
+	// Send a Feature Report to the device
+	cmd->seq = dlusb_next_seq();
+	cmd->t_sent = dl_time_us();
+	res = dlusb_send(cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->repeats, cmd->seq, handle);
+	if (res < 0) {
+		printf("ERROR: Unable to send a feature report.\n");
+		return 1;
+	}
+	else
+		printf("Command sent to device. Waiting for a reply...\n");
+
+	// Read a Feature Report from the device
+	res = dlusb_wait_ack(cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->seq, handle, arguments.verbose, &latency_us);
+	cmd->t_done = dl_time_us();
+	if (res == DLUSB_OK) {
+		printf("Device acks codes correctly.\n");
+		if (arguments.verbose)
+			printf("Command completed in %.1f ms (ACK latency %.1f ms).\n", (cmd->t_done - cmd->t_sent) / 1000.0, latency_us / 1000.0);
+
+		if (dlusb_times_requested(handle)) {
+			dlusb_times_packet_t times;
+			if (dlusb_wait_times(&times, cmd->seq, handle, arguments.verbose) == DLUSB_OK) {
+				cmd->queue_ms = times.queue_ms;
+				cmd->air_ms = times.air_ms;
+				printf("Latency %.1f ms:\n", (cmd->t_done - cmd->t_sent) / 1000.0);
+				dl_batch_print_times(cmd);
+			}
+			else
+				printf("WARN: No timings from device.\n");
+		}
+	}
+	else {
+		if (res == DLUSB_ERR_TIMEOUT)
+			printf("ERROR: No reply from device!\n");
+		else if (res == DLUSB_ERR_STATUS)
+			printf("ERROR: Device reported an error!\n");
+		else
+			printf("ERROR: Got wrong reply from device!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/// @brief Sets RF timing profile from the -T argument if given, then prints the profile in effect.
+/// @return program exit code
+static int run_timing(dl_device_t* handle)
+{
+	dl_timing_t timing;
+	unsigned int start, bit, half, repeats, gap;
+	char end;
+	error_t res;
+
+	if (!dlusb_has_timing(handle)) {
+		printf("ERROR: Device firmware doesn't support RF timing profile.\n");
+		return 1;
+	}
+
+	if (*arguments.timing != '\0') {
+		memset(&timing, 0, sizeof(timing));
+		if (strcmp(arguments.timing, "default") != 0) {
+			if (sscanf(arguments.timing, "%u,%u,%u,%u,%u%c", &start, &bit, &half, &repeats, &gap, &end) != 5 || \
+				start > UINT16_MAX || bit > UINT16_MAX || half > UINT16_MAX || repeats == 0 || repeats > UINT8_MAX || gap > UINT16_MAX) {
+				printf("ERROR: expected START,BIT,HALF,REPEATS,GAP timing values, REPEATS 1-255\n");
+				return 1;
+			}
+			timing.start_us = (uint16_t)start;
+			timing.bit_us = (uint16_t)bit;
+			timing.half_us = (uint16_t)half;
+			timing.repeats = (uint8_t)repeats;
+			timing.gap_ms = (uint16_t)gap;
+		}
+
+		res = dlusb_set_timing(&timing, handle, arguments.verbose);
+		if (res == DLUSB_ERR_STATUS) {
+			printf("ERROR: Device rejected RF timing profile, value out of range.\n");
+			return 1;
+		}
+		else if (res != DLUSB_OK) {
+			printf("ERROR: Unable to set RF timing profile: %s\n", dlusb_strerror(res));
+			return 1;
+		}
+	}
+
+	if (dlusb_get_timing(&timing, handle) < 0) {
+		printf("ERROR: Unable to read RF timing profile.\n");
+		return 1;
+	}
+	printf("RF timing: start %u us, bit %u us, half bit %u us, %u repeats, gap %u ms.\n", timing.start_us, \
+		timing.bit_us, timing.half_us, timing.repeats, timing.gap_ms);
+
+	return 0;
+}
+
+/// @brief Prints device counters, one "name: value" per line, so they're easy to parse for graphs.
+/// @return program exit code
+static int run_stats(dl_device_t* handle)
+{
+	dlusb_stats_packet_t stats;
+
+	if (!dlusb_has_stats(handle)) {
+		printf("ERROR: Device firmware doesn't support stats report.\n");
+		return 1;
+	}
+
+	if (dlusb_get_stats(&stats, handle) < 0) {
+		printf("ERROR: Unable to read device stats.\n");
+		return 1;
+	}
+
+	printf("commands: %u\n", stats.commands);
+	printf("rx_overflows: %u\n", stats.rx_overflows);
+	printf("unknown_commands: %u\n", stats.unknown);
+	printf("bursts: %u\n", stats.bursts);
+	printf("frames: %u\n", stats.frames);
+	printf("airtime_ms: %u\n", stats.airtime_ms);
+	printf("usb_resets: %u\n", stats.usb_resets);
+	printf("loop_max_us: %u\n", stats.loop_max_us);
+
+	return 0;
+}
+
+/// @brief Uploads scene table and/or plays a scene, printing progress messages.
+/// @return program exit code
+static int run_scenes(dl_device_t* handle)
+{
+	uint64_t start;
+	error_t res;
+
+	if (!dlusb_has_scenes(handle)) {
+		printf("ERROR: Device firmware doesn't support scenes.\n");
+		return 1;
+	}
+
+	if (arguments.scenes_file) {
+		start = dl_time_us();
+		res = dl_scenes_upload(&scenes, handle, arguments.verbose);
+		if (res != DLUSB_OK) {
+			printf("ERROR: Unable to write scene table: %s\n", dlusb_strerror(res));
+			return 1;
+		}
+		printf("Scene table written (%zu bytes) in %.1f ms.\n", scenes.size, (dl_time_us() - start) / 1000.0);
+	}
+
+	if (arguments.scene_id >= 0) {
+		start = dl_time_us();
+		res = dl_scene_play((uint8_t)arguments.scene_id, handle, arguments.verbose);
+		if (res == DLUSB_ERR_STATUS)
+			printf("ERROR: Device reported an error, no scene %d stored?\n", arguments.scene_id);
+		else if (res != DLUSB_OK)
+			printf("ERROR: Scene %d: %s\n", arguments.scene_id, dlusb_strerror(res));
+		else
+			printf("Scene %d played in %.1f ms.\n", arguments.scene_id, (dl_time_us() - start) / 1000.0);
+
+		if (res != DLUSB_OK)
+			return 1;
+	}
+
+	return 0;
+}
+
+/// @brief Sends all commands over one device handle, printing one result line per command.
+/// @return program exit code
+static int run_batch(dl_device_t* handle)
+{
+	uint64_t start = dl_time_us();
+	size_t failed;
+
+	failed = dl_batch_run(&arguments.cmds, handle, arguments.verbose);
+
+	double total_ms = (dl_time_us() - start) / 1000.0;
+	printf("%zu commands sent, %zu failed, %.1f ms total (%.2f commands/s).\n", arguments.cmds.count, failed, \
+		total_ms, total_ms > 0 ? arguments.cmds.count * 1000.0 / total_ms : 0.0);
+
+	return failed ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
-	hid_device* handle = NULL;
-	struct hid_device_info* devices, * dl_dev;
-	dlusb_packet_t packet;
+	dl_device_t* handle = NULL;
+	struct hid_device_info* devices;
 	int res;
 
 	// [argp] Default values.
-	arguments.remote_id = 0;
-	arguments.btn_id = 0;
+	memset(&arguments.cmds, 0, sizeof(arguments.cmds));
+	arguments.batch_file = NULL;
+	arguments.scenes_file = NULL;
+	arguments.scene_id = -1;
+	arguments.timing = NULL;
+	arguments.stats = false;
+	arguments.latency = false;
+	arguments.repeats = 0;
 	arguments.verbose = false;
 	arguments.old_alg = false;
+	arguments.socket_path = NULL;
+	arguments.transport = NULL;
 
 	// Print program name & version
 	printf("%s\n", PROG_NAME_VERSION);
@@ -66,10 +307,78 @@ int main(int argc, char* argv[])
 	 * be reflected in arguments. */
 	argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
+	// -o & -r options apply to all commands given as arguments, they could be set after them.
+	for (size_t i = 0; i < arguments.cmds.count; i++) {
+		arguments.cmds.cmds[i].old_alg = arguments.old_alg;
+		arguments.cmds.cmds[i].repeats = arguments.repeats;
+	}
+
+	if (arguments.batch_file && !arguments.list_devices) {
+		FILE* stream = (strcmp(arguments.batch_file, "-") == 0) ? stdin : fopen(arguments.batch_file, "r");
+		if (!stream) {
+			printf("ERROR: unable to open %s\n", arguments.batch_file);
+			return 1;
+		}
+
+		res = dl_batch_load(&arguments.cmds, stream, arguments.repeats, arguments.old_alg);
+		if (stream != stdin)
+			fclose(stream);
+
+		if (res != 0) {
+			if (res > 0)
+				printf("ERROR: %s:%d: expected REMOTE_ID KEY_CODE [REPEATS] [old]\n", arguments.batch_file, res);
+			else
+				printf("ERROR: out of memory\n");
+			dl_batch_free(&arguments.cmds);
+			return 1;
+		}
+	}
+
+	if (arguments.scenes_file && !arguments.list_devices) {
+		FILE* stream = fopen(arguments.scenes_file, "r");
+		if (!stream) {
+			printf("ERROR: unable to open %s\n", arguments.scenes_file);
+			return 1;
+		}
+
+		res = dl_scenes_load(&scenes, stream);
+		fclose(stream);
+
+		if (res != 0) {
+			printf("ERROR: %s:%d: expected \"scene ID NAME [GAP_MS]\" or \"REMOTE_ID KEY_CODE [old]\" line fitting in %d bytes table\n", \
+				arguments.scenes_file, res, DL_SCENES_SIZE);
+			dl_batch_free(&arguments.cmds);
+			return 1;
+		}
+	}
+
 	if (arguments.verbose) {
 		printf("Compiled with hidapi version %s, runtime version %s.\n", HID_API_VERSION_STR, hid_version_str());
-		printf("Arguments: REMOTE_ID = %d, KEY_CODE = %d\n", arguments.remote_id, arguments.btn_id);
+		if (arguments.cmds.count == 1)
+			printf("Arguments: REMOTE_ID = %d, KEY_CODE = %d\n", arguments.cmds.cmds[0].remote_id, arguments.cmds.cmds[0].btn_id);
+		else
+			printf("Commands to send: %zu\n", arguments.cmds.count);
+	}
+
+	bool use_scenes = (arguments.scenes_file || arguments.scene_id >= 0);
+
+	if (arguments.cmds.count == 0 && !arguments.list_devices && !use_scenes && !arguments.timing && !arguments.stats) {
+		printf("No commands to send.\n");
+		return 0;
+	}
+
+#ifndef _WIN32
+	if (arguments.socket_path && !arguments.list_devices) {
+		if (use_scenes || arguments.timing || arguments.stats || arguments.latency) {
+			printf("ERROR: scenes, RF timing, stats & latency can't be used via digilivolod\n");
+			dl_batch_free(&arguments.cmds);
+			return 1;
+		}
+		res = run_client();
+		dl_batch_free(&arguments.cmds);
+		return res;
 	}
+#endif
 
 	if (hid_init())
 		return -1;
@@ -82,39 +391,7 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
-#if defined(__APPLE__) && HID_API_VERSION >= HID_API_MAKE_VERSION(0, 12, 0)
-	// To work properly needs to be called before hid_open/hid_open_path after hid_init.
-	// Best/recommended option - call it right after hid_init.
-	hid_darwin_set_open_exclusive(0);
-#endif
-
-	devices = hid_enumerate(DIGILIVOLO_VID, DIGILIVOLO_PID);
-	dl_dev = find_digilivolo(devices);
-	if (!dl_dev) {
-		printf("ERROR: unable to find device\n");
-		if (arguments.verbose) {
-			if (devices) {
-				printf("Devices with matching VID/PID (0x%04x:0x%04x), but wrong product or manufacturer string:\n", DIGILIVOLO_VID, DIGILIVOLO_PID);
-				print_devices(devices);
-			}
-			else {
-				hid_free_enumeration(devices);
-				devices = hid_enumerate(0, 0);
-				printf("All enumerated devices, but none of them match VID/PID (0x%04x:0x%04x):\n", DIGILIVOLO_VID, DIGILIVOLO_PID);
-				print_devices(devices);
-			}
-		}
-	}
-	else {
-		if (arguments.verbose) {
-			printf("Device found: ");
-			print_device(dl_dev);
-			printf("Opening device path: %s\n", dl_dev->path);
-		}
-		handle = hid_open_path(dl_dev->path);
-	}
-
-	hid_free_enumeration(devices);
+	handle = dlusb_open(arguments.transport, arguments.verbose);
 
 	// Check if devices was opened succesfully previously
 	if (!handle) {
@@ -123,99 +400,49 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
-	struct hid_device_info* info = hid_get_device_info(handle);
-	if (info == NULL) {
-		printf("ERROR: Unable to get device info\n");
-		hid_close(handle);
-		hid_exit();
-		return 1;
-	}
-
-	// Set the hid_read() function to be non-blocking.
-	hid_set_nonblocking(handle, 1);
-
-	res = 1;
-	while (res) {
-		res = dlusb_read(&packet, handle);
-		if (res < 0) {
-			printf("WARN: (%d) Unable to get a feature report: %ls\n", res, hid_error(handle));
+	if (handle->release_number < 0x200) {
+		bool warn = false;
+		for (size_t i = 0; i < arguments.cmds.count; i++) {
+			warn |= arguments.cmds.cmds[i].old_alg;
+			arguments.cmds.cmds[i].old_alg = false;
 		}
-		else if (res > 0 && arguments.verbose) {
-#ifdef DEBUG
-			// Print out the returned buffer.
-			printf("Read Feature Report from DigiLivolo: ");
-			for (uint32_t i = 0; i < res; i++)
-				printf("%02x ", *(((uint8_t*)&packet) + i));
-			printf("\n");
-#endif // DEBUG
-		}
-	}
-
-	if (arguments.old_alg && info->release_number < 0x200) {
-		arguments.old_alg = false;
-		if (arguments.verbose) {
+		if (warn && arguments.verbose) {
 			printf("WARN: Device firmware version doesn't supports old-alg feature. Using default, which should be old algorithm anyways.\n");
 		}
 	}
 
-	// Send a Feature Report to the device
-	res = dlusb_send(arguments.remote_id, arguments.btn_id, arguments.old_alg, handle);
-	if (res < 0) {
-		printf("ERROR: Unable to send a feature report.\n");
-		hid_close(handle);
-		hid_exit();
-		return 1;
+	if (!dlusb_has_repeats(handle)) {
+		bool warn = false;
+		for (size_t i = 0; i < arguments.cmds.count; i++)
+			warn |= (arguments.cmds.cmds[i].repeats != 0);
+		if (warn)
+			printf("WARN: Device firmware doesn't support repeat count, codes are sent with its default.\n");
 	}
-	else
-		printf("Command sent to device. Waiting for a reply...\n");
 
-	// Read a Feature Report from the device
-	res = 0;
-
-	while (res == 0) {
-		dl_sleep_ms(300);
-		res = dlusb_read(&packet, handle);
-		if (res == -1) { // This error usually means that the hardware didn't finished processing yet, give it one more try after delay
-			if (arguments.verbose) {
-				printf("WARN: (%d) Unable to get ACK feature report: %ls.\n", res, hid_error(handle));
-				dl_sleep_ms(10);
-				printf(" Retrying...\n");
-			}
-			dl_sleep_ms(300);
-			res = dlusb_read(&packet, handle);
-		}
-		if (res < 0) {
-			printf("WARN: (%d) Unable to get ACK feature report: %ls\n", res, hid_error(handle));
-			continue;
-		}
-		else if (res > 0) {
-			if (packet.cmd_id == ((arguments.old_alg == true) ? CMD_SWITCH_OLD : CMD_SWITCH) && \
-				packet.remote_id == arguments.remote_id && packet.btn_id == arguments.btn_id) {
-				printf("Device acks codes correctly.\n");
-			}
-			else {
-				printf("ERROR: Got wrong reply from device!\n");
-				hid_close(handle);
+	if (arguments.latency && !dlusb_request_times(handle, true))
+		printf("WARN: Device firmware doesn't report command timings, latency breakdown is unavailable.\n");
 
-				/* Free static HIDAPI objects. */
-				hid_exit();
+	res = arguments.timing ? run_timing(handle) : 0;
+	if (res == 0 && use_scenes)
+		res = run_scenes(handle);
 
-				return -1;
-			}
-#ifdef DEBUG
-			// Print out the returned buffer.
-			printf("Read Feature Report from DigiLivolo: ");
-			for (uint32_t i = 0; i < res; i++)
-				printf("%02x ", *(((uint8_t*)&packet) + i));
-			printf("\n");
-#endif // DEBUG
-		}
+	if (res == 0 && arguments.cmds.count == 1 && !arguments.batch_file)
+		res = run_single(&arguments.cmds.cmds[0], handle);
+	else if (res == 0 && arguments.cmds.count > 0)
+		res = run_batch(handle);
+
+	// Counters are useful after a failure too
+	if (arguments.stats) {
+		int stats_res = run_stats(handle);
+		if (res == 0)
+			res = stats_res;
 	}
 
-	hid_close(handle);
+	dl_close(handle);
+	dl_batch_free(&arguments.cmds);
 
 	/* Free static HIDAPI objects. */
 	hid_exit();
 
-	return 0;
+	return res;
 }
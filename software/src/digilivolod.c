@@ -0,0 +1,318 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <argp.h>
+
+#include "defs.h"
+#include "git_version.h"
+
+#include <hidapi.h>
+#include "transport.h"
+#include "usb_func.h"
+#include "ipc.h"
+#include "batch.h"
+
+/// @brief Maximum number of simultaneously connected clients.
+#define DL_MAX_CLIENTS 16
+
+const char* argp_program_version = GIT_VERSION;
+const char* argp_program_bug_address = "https://github.com/N-Storm/DigiLivolo/\n\
+Copyright (c) 2024 GitHub user N-Storm.\n\
+License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>";
+
+static const char d_doc[] = "\nDaemon which keeps DigiLivolo device open and accepts commands over a Unix-domain socket.\n\
+Commands are text lines in \"REMOTE_ID KEY_CODE [REPEATS] [old]\" format, replies are \"OK <milliseconds>\"\n\
+or \"ERR <message>\" lines.\n\
+Use \"digilivolo -s\" to send commands to the daemon.\n";
+
+static struct argp_option d_options[] = {
+  {"socket",    's', "PATH",  0, "Unix socket path (default: " DL_IPC_SOCKET_PATH ")" },
+  {"transport", 't', "SPEC",  0, "Talk to the device via transport set as NAME[:ARGS]: hidapi (default), hidraw (Linux), libusb or emu (built-in device emulator)" },
+  {"verbose",   'v',      0,  0, "Produce verbose output"                              },
+  { 0 }
+};
+
+/// @brief Daemon command-line arguments.
+static struct d_arguments {
+	const char* socket_path;
+	const char* transport;
+	bool verbose;
+} d_args;
+
+/// @brief Per-client connection state.
+typedef struct client {
+	int fd;
+	size_t len;
+	char buf[DL_IPC_LINE_MAX];
+} client_t;
+
+static volatile sig_atomic_t running = 1;
+static dl_device_t* handle = NULL;
+static unsigned short fw_version = 0;
+
+static error_t d_parse_opt(int key, char* arg, struct argp_state* state)
+{
+	struct d_arguments* args = state->input;
+
+	switch (key) {
+	case 's':
+		args->socket_path = arg;
+		break;
+	case 't':
+		if (!dl_transport_valid(arg))
+			argp_error(state, "unknown transport %s", arg);
+		args->transport = arg;
+		break;
+	case 'v':
+		args->verbose = true;
+		break;
+	case ARGP_KEY_ARG:
+		// No positional arguments
+		argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp d_argp = { d_options, d_parse_opt, 0, d_doc };
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+/// @brief Opens DigiLivolo device if it's not opened already.
+/// @return true if device is open
+static bool device_open(void)
+{
+	if (handle)
+		return true;
+
+	handle = dlusb_open(d_args.transport, d_args.verbose);
+	if (!handle)
+		return false;
+
+	fw_version = handle->release_number;
+	printf("Device opened, firmware version %d.%02d.\n", fw_version >> 8, fw_version & 0xFF);
+
+	return true;
+}
+
+static void device_close(void)
+{
+	if (handle) {
+		dl_close(handle);
+		handle = NULL;
+	}
+}
+
+/// @brief Executes one command line received from the client and builds the reply line.
+/// @param line[in] command line
+/// @param reply[out] reply line buffer, newline terminated
+/// @param len[in] reply buffer size
+static void process_line(const char* line, char* reply, size_t len)
+{
+	uint16_t remote_id;
+	uint8_t btn_id, repeats;
+	bool old_alg;
+	uint32_t latency_us = 0;
+	error_t res;
+
+	if (!dl_parse_cmd(line, &remote_id, &btn_id, &repeats, &old_alg)) {
+		snprintf(reply, len, "ERR syntax: expected REMOTE_ID KEY_CODE [REPEATS] [old]\n");
+		return;
+	}
+
+	if (!device_open()) {
+		snprintf(reply, len, "ERR unable to open device\n");
+		return;
+	}
+
+	if (old_alg && fw_version < 0x200)
+		old_alg = false;
+
+	res = dlusb_switch(remote_id, btn_id, old_alg, repeats, handle, d_args.verbose, &latency_us);
+	if (res == DLUSB_ERR_SEND) {
+		// Device might have been replugged or reset, reopen it & retry once.
+		printf("WARN: Unable to send a feature report, reopening device.\n");
+		device_close();
+		if (device_open())
+			res = dlusb_switch(remote_id, btn_id, old_alg, repeats, handle, d_args.verbose, &latency_us);
+	}
+
+	if (d_args.verbose)
+		printf("Command %u %u%s: %s, %.1f ms\n", remote_id, btn_id, old_alg ? " old" : "", res == DLUSB_OK ? "OK" : "FAIL", latency_us / 1000.0);
+
+	if (res == DLUSB_OK)
+		snprintf(reply, len, "OK %.1f\n", latency_us / 1000.0);
+	else
+		snprintf(reply, len, "ERR %s\n", dlusb_strerror(res));
+}
+
+/// @brief Reads available data from the client & processes all complete lines.
+/// @return false if client should be disconnected
+static bool client_service(client_t* client)
+{
+	char reply[DL_IPC_LINE_MAX];
+	ssize_t res;
+
+	res = read(client->fd, client->buf + client->len, sizeof(client->buf) - client->len - 1);
+	if (res < 0)
+		return (errno == EINTR || errno == EAGAIN);
+	else if (res == 0)
+		return false;
+
+	client->len += (size_t)res;
+	client->buf[client->len] = '\0';
+
+	char* nl;
+	while ((nl = strchr(client->buf, '\n')) != NULL) {
+		*nl = '\0';
+		process_line(client->buf, reply, sizeof(reply));
+		if (dl_ipc_write(client->fd, reply, strlen(reply)) < 0)
+			return false;
+
+		// Move remaining data to the buffer start
+		client->len -= (size_t)(nl + 1 - client->buf);
+		memmove(client->buf, nl + 1, client->len + 1);
+	}
+
+	if (client->len >= sizeof(client->buf) - 1) {
+		const char* err = "ERR line too long\n";
+		dl_ipc_write(client->fd, err, strlen(err));
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	struct pollfd fds[DL_MAX_CLIENTS + 1];
+	client_t clients[DL_MAX_CLIENTS];
+	int nclients = 0;
+	int listen_fd;
+	ino_t socket_ino;
+
+	d_args.socket_path = DL_IPC_SOCKET_PATH;
+	d_args.transport = NULL;
+	d_args.verbose = false;
+
+	argp_parse(&d_argp, argc, argv, 0, 0, &d_args);
+
+	// Line buffered output, so logs are visible immediately when redirected
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("digilivolod %s\n", GIT_VERSION);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (hid_init())
+		return -1;
+
+	// Before opening the device, which another daemon instance may keep open
+	listen_fd = dl_ipc_listen(d_args.socket_path, &socket_ino);
+	if (listen_fd < 0) {
+		if (errno == EADDRINUSE)
+			printf("ERROR: digilivolod is already running on %s\n", d_args.socket_path);
+		else
+			printf("ERROR: unable to listen on %s: %s\n", d_args.socket_path, strerror(errno));
+		hid_exit();
+		return 1;
+	}
+	printf("Listening on %s\n", d_args.socket_path);
+
+	// Open device early, so the first command doesn't pay for it. It's not fatal if device is absent yet.
+	device_open();
+
+	while (running) {
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (int i = 0; i < nclients; i++) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+
+		if (poll(fds, (nfds_t)nclients + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("ERROR: poll() failed: %s\n", strerror(errno));
+			break;
+		}
+
+		// Service clients first, as accepting new one modifies the array
+		for (int i = nclients - 1; i >= 0; i--) {
+			if (fds[i + 1].revents == 0)
+				continue;
+			if ((fds[i + 1].revents & POLLIN) && client_service(&clients[i]))
+				continue;
+
+			close(clients[i].fd);
+			clients[i] = clients[--nclients];
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd >= 0) {
+				if (nclients < DL_MAX_CLIENTS) {
+					clients[nclients].fd = fd;
+					clients[nclients].len = 0;
+					nclients++;
+				}
+				else {
+					const char* err = "ERR too many clients\n";
+					dl_ipc_write(fd, err, strlen(err));
+					close(fd);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < nclients; i++)
+		close(clients[i].fd);
+	close(listen_fd);
+	// Another instance may have replaced a socket removed from under us
+	dl_ipc_unlink(d_args.socket_path, socket_ino);
+
+	device_close();
+
+	/* Free static HIDAPI objects. */
+	hid_exit();
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __dl_time_h__
+#define __dl_time_h__
+
+/// @brief Returns monotonic clock value in microseconds. Not related to wall clock time,
+///        used to measure intervals & deadlines only.
+/// @return microseconds since some unspecified starting point
+extern uint64_t dl_time_us(void);
+
+/// @brief Sleeps for a specified number of milliseconds.
+/// @param ms[in] milliseconds to sleep
+extern void dl_sleep_ms(uint32_t ms);
+
+#endif // __dl_time_h__
@@ -0,0 +1,403 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Linux only: virtual DigiLivolo device created with uhid. Kernel exposes it as a hidraw
+ * node with the firmware VID/PID & report descriptor, feature report requests are answered
+ * by the device emulator (transport_emu.c), so the unmodified digilivolo can be run & timed
+ * end-to-end through the kernel HID stack without the hardware. */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <argp.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include "defs.h"
+#include "git_version.h"
+
+#include "transport.h"
+
+#define DLUHID_DEV_PATH "/dev/uhid"
+// Interrupt IN replies are polled from the emulator this often, ms
+#define DLUHID_POLL_MS 1
+
+const char* argp_program_version = GIT_VERSION;
+const char* argp_program_bug_address = "https://github.com/N-Storm/DigiLivolo/\n\
+Copyright (c) 2024 GitHub user N-Storm.\n\
+License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>";
+
+static const char u_doc[] = "\nCreates virtual DigiLivolo device with Linux uhid for end-to-end tests through the kernel HID stack.\n\
+Device requests are answered by the built-in device emulator until interrupted.\n\
+Requires write access to " DLUHID_DEV_PATH ".\n";
+
+static struct argp_option u_options[] = {
+  {"speed",   's', "N",    0, "Emulator speed-up factor (1-1000, default 1)" },
+  {"uhid",    'u', "PATH", 0, "uhid device path (default: " DLUHID_DEV_PATH ")" },
+  {"verbose", 'v',      0, 0, "Print every device request"                   },
+  { 0 }
+};
+
+/// @brief dluhid command-line arguments.
+static struct u_arguments {
+	const char* speed;
+	const char* uhid_path;
+	bool verbose;
+} u_args;
+
+/* HID report descriptor, same as usbHidReportDescriptor in firmware/lib/DLUSB/DLUSB.cpp:
+ * vendor defined input report REPORT_ID & feature reports with DLUSB packet sizes. */
+static const uint8_t report_descriptor[] = {
+	0x05, 0x84,         // USAGE_PAGE (Power Device)
+	0x09, 0x6b,         // USAGE (Generic HID Transfer)
+	0xa1, 0x01,         // COLLECTION (Application)
+	0x09, 0x6b,         //   USAGE (Generic HID Transfer)
+	0x15, 0x00,         //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,   //   LOGICAL_MAXIMUM (255)
+	0x85, REPORT_ID,    //   REPORT_ID (REPORT_ID)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x75, 0x08,         //   REPORT_SIZE (8)
+	0x95, sizeof(dlusb_packet_t) - 1, //   REPORT_COUNT
+	0xb2, 0x02, 0x01,   //   FEATURE (Data,Var,Abs,Buf)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x81, 0x02,         //   INPUT (Data,Var,Abs)
+	0x85, REPORT_ID_MULTI, //   REPORT_ID (REPORT_ID_MULTI)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x95, sizeof(dlusb_multi_packet_t) - 1, //   REPORT_COUNT
+	0xb2, 0x02, 0x01,   //   FEATURE (Data,Var,Abs,Buf)
+	0x85, REPORT_ID_STATUS, //   REPORT_ID (REPORT_ID_STATUS)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x95, sizeof(dlusb_status_packet_t) - 1, //   REPORT_COUNT
+	0xb2, 0x02, 0x01,   //   FEATURE (Data,Var,Abs,Buf)
+	0x85, REPORT_ID_DATA, //   REPORT_ID (REPORT_ID_DATA)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x95, sizeof(dlusb_data_packet_t) - 1, //   REPORT_COUNT
+	0xb2, 0x02, 0x01,   //   FEATURE (Data,Var,Abs,Buf)
+	0x85, REPORT_ID_STATS, //   REPORT_ID (REPORT_ID_STATS)
+	0x09, 0x52,         //   USAGE (Generic HID Transfer)
+	0x95, sizeof(dlusb_stats_packet_t) - 1, //   REPORT_COUNT
+	0xb2, 0x02, 0x01,   //   FEATURE (Data,Var,Abs,Buf)
+	0xc0                // END_COLLECTION
+};
+
+_Static_assert(sizeof(report_descriptor) == 65, "report_descriptor should match USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH");
+
+static volatile sig_atomic_t running = 1;
+
+static error_t u_parse_opt(int key, char* arg, struct argp_state* state)
+{
+	struct u_arguments* args = state->input;
+
+	switch (key) {
+	case 's':
+		args->speed = arg;
+		break;
+	case 'u':
+		args->uhid_path = arg;
+		break;
+	case 'v':
+		args->verbose = true;
+		break;
+	case ARGP_KEY_ARG:
+		// No positional arguments
+		argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp u_argp = { u_options, u_parse_opt, 0, u_doc };
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+/// @brief Writes an event to uhid.
+/// @return true on success
+static bool uhid_write(int fd, const struct uhid_event* ev)
+{
+	ssize_t res = write(fd, ev, sizeof(*ev));
+
+	if (res != (ssize_t)sizeof(*ev)) {
+		printf("ERROR: uhid write failed: %s\n", res < 0 ? strerror(errno) : "short write");
+		return false;
+	}
+
+	return true;
+}
+
+/// @brief Creates the virtual device.
+/// @param uniq[in] unique ID (serial number) to find the hidraw node by
+static bool uhid_create(int fd, unsigned short release_number, const char* uniq)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	// hidapi reports HID name as the product string of the virtual devices
+	snprintf((char*)ev.u.create2.name, sizeof(ev.u.create2.name), "%ls", DIGILIVOLO_PRODUCT_STRING);
+	snprintf((char*)ev.u.create2.phys, sizeof(ev.u.create2.phys), "dluhid");
+	snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", uniq);
+	ev.u.create2.rd_size = sizeof(report_descriptor);
+	memcpy(ev.u.create2.rd_data, report_descriptor, sizeof(report_descriptor));
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = DIGILIVOLO_VID;
+	ev.u.create2.product = DIGILIVOLO_PID;
+	ev.u.create2.version = release_number;
+	ev.u.create2.country = 0;
+
+	return uhid_write(fd, &ev);
+}
+
+/// @brief Finds hidraw node of the virtual device by its unique ID in sysfs.
+/// @param uniq[in] unique ID the device was created with
+/// @param path[out] buffer for "/dev/hidrawN"
+/// @return true if found
+static bool find_hidraw(const char* uniq, char* path, size_t len)
+{
+	DIR* dir = opendir("/sys/class/hidraw");
+	struct dirent* ent;
+	char fname[512], line[256], match[128];
+	bool found = false;
+
+	if (!dir)
+		return false;
+
+	snprintf(match, sizeof(match), "HID_UNIQ=%s\n", uniq);
+	while (!found && (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(fname, sizeof(fname), "/sys/class/hidraw/%s/device/uevent", ent->d_name);
+		FILE* f = fopen(fname, "r");
+		if (!f)
+			continue;
+
+		while (fgets(line, sizeof(line), f)) {
+			if (strcmp(line, match) == 0) {
+				snprintf(path, len, "/dev/%s", ent->d_name);
+				found = true;
+				break;
+			}
+		}
+		fclose(f);
+	}
+
+	closedir(dir);
+	return found;
+}
+
+/// @brief Answers GET_REPORT request with the emulator feature report.
+static bool on_get_report(int fd, dl_device_t* dev, const struct uhid_get_report_req* req)
+{
+	struct uhid_event ev;
+	int res = -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_GET_REPORT_REPLY;
+	ev.u.get_report_reply.id = req->id;
+
+	if (req->rtype == UHID_FEATURE_REPORT) {
+		ev.u.get_report_reply.data[0] = req->rnum;
+		res = dev->transport->get_feature_report(dev, ev.u.get_report_reply.data, UHID_DATA_MAX);
+	}
+
+	if (res < 0)
+		ev.u.get_report_reply.err = EIO;
+	else
+		ev.u.get_report_reply.size = (uint16_t)res;
+
+	if (u_args.verbose)
+		printf("GET_REPORT 0x%02x: %d bytes\n", req->rnum, res);
+
+	return uhid_write(fd, &ev);
+}
+
+/// @brief Passes SET_REPORT request to the emulator. Rejected reports are stalled, as the
+///        firmware does with full command queue.
+static bool on_set_report(int fd, dl_device_t* dev, const struct uhid_set_report_req* req)
+{
+	struct uhid_event ev;
+	int res = -1;
+
+	if (req->rtype == UHID_FEATURE_REPORT && req->size > 0)
+		res = dev->transport->send_feature_report(dev, req->data, req->size);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_SET_REPORT_REPLY;
+	ev.u.set_report_reply.id = req->id;
+	ev.u.set_report_reply.err = (res < 0) ? EPIPE : 0;
+
+	if (u_args.verbose)
+		printf("SET_REPORT 0x%02x: %u bytes, %s\n", req->rnum, req->size, res < 0 ? "stalled" : "OK");
+
+	return uhid_write(fd, &ev);
+}
+
+/// @brief Pushes replies emulator has for the interrupt IN endpoint as input reports.
+static bool push_input(int fd, dl_device_t* dev)
+{
+	struct uhid_event ev;
+	int res;
+
+	for (;;) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		res = dev->transport->read_timeout(dev, ev.u.input2.data, UHID_DATA_MAX, 0);
+		if (res <= 0)
+			return true;
+
+		ev.u.input2.size = (uint16_t)res;
+		if (u_args.verbose)
+			printf("INPUT 0x%02x: %d bytes\n", ev.u.input2.data[0], res);
+		if (!uhid_write(fd, &ev))
+			return false;
+	}
+}
+
+/// @brief Processes one event from uhid.
+/// @param started[out] set when the kernel has started the device
+/// @return false on fatal error
+static bool uhid_event(int fd, dl_device_t* dev, bool* started)
+{
+	struct uhid_event ev;
+	ssize_t res;
+
+	res = read(fd, &ev, sizeof(ev));
+	if (res < 0)
+		return (errno == EINTR || errno == EAGAIN);
+	else if (res == 0)
+		return false;
+
+	switch (ev.type) {
+	case UHID_START:
+		*started = true;
+		break;
+	case UHID_STOP:
+		printf("Virtual device stopped\n");
+		*started = false;
+		break;
+	case UHID_OPEN:
+	case UHID_CLOSE:
+		if (u_args.verbose)
+			printf("Virtual device %s\n", ev.type == UHID_OPEN ? "opened" : "closed");
+		break;
+	case UHID_GET_REPORT:
+		return on_get_report(fd, dev, &ev.u.get_report);
+	case UHID_SET_REPORT:
+		return on_set_report(fd, dev, &ev.u.set_report);
+	default:
+		// Output reports via hidraw write() aren't used by the firmware
+		break;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	struct pollfd pfd;
+	char uniq[32], path[300];
+	bool started = false, announced = false;
+	int fd, ret = 0;
+
+	u_args.speed = NULL;
+	u_args.uhid_path = DLUHID_DEV_PATH;
+	u_args.verbose = false;
+
+	argp_parse(&u_argp, argc, argv, 0, 0, &u_args);
+
+	// Line buffered output, so logs are visible immediately when redirected
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	dl_device_t* dev = dl_transport_emu.open(u_args.speed, true);
+	if (!dev)
+		return 1;
+
+	fd = open(u_args.uhid_path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		printf("ERROR: unable to open %s: %s\n", u_args.uhid_path, strerror(errno));
+		dev->transport->close(dev);
+		return 1;
+	}
+
+	snprintf(uniq, sizeof(uniq), "dluhid-%ld", (long)getpid());
+	if (!uhid_create(fd, dev->release_number, uniq)) {
+		close(fd);
+		dev->transport->close(dev);
+		return 1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (running) {
+		int res = poll(&pfd, 1, DLUHID_POLL_MS);
+		if (res < 0 && errno != EINTR) {
+			printf("ERROR: poll() failed: %s\n", strerror(errno));
+			ret = 1;
+			break;
+		}
+
+		if (res > 0 && !uhid_event(fd, dev, &started)) {
+			ret = 1;
+			break;
+		}
+
+		// hidraw node shows up after the start event, once the kernel has connected the device
+		if (started && !announced && find_hidraw(uniq, path, sizeof(path))) {
+			printf("Virtual device started: %s\n", path);
+			announced = true;
+		}
+
+		if (!push_input(fd, dev)) {
+			ret = 1;
+			break;
+		}
+	}
+
+	struct uhid_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	uhid_write(fd, &ev);
+	close(fd);
+
+	dev->transport->close(dev);
+
+	return ret;
+}
@@ -0,0 +1,177 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+
+/// @brief Fills sockaddr_un with a socket path.
+/// @return 0 on success, -1 if path doesn't fit
+static int mk_sockaddr(struct sockaddr_un* addr, const char* path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+int dl_ipc_listen(const char* path, ino_t* ino)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (mk_sockaddr(&addr, path) < 0)
+		return -1;
+
+	// Socket is live if a daemon accepts on it, don't take it over
+	fd = dl_ipc_connect(path);
+	if (fd >= 0) {
+		close(fd);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	else if (errno == ECONNREFUSED) {
+		// Left by a previous daemon instance which hasn't removed it
+		if (unlink(path) < 0)
+			return -1;
+	}
+	else if (errno != ENOENT)
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0 || stat(path, &st) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	*ino = st.st_ino;
+	return fd;
+}
+
+void dl_ipc_unlink(const char* path, ino_t ino)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0 && st.st_ino == ino)
+		unlink(path);
+}
+
+int dl_ipc_connect(const char* path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (mk_sockaddr(&addr, path) < 0)
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+error_t dl_ipc_write(int fd, const char* buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t res = write(fd, buf, len);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += res;
+		len -= (size_t)res;
+	}
+
+	return 0;
+}
+
+int dl_ipc_readline(int fd, char* buf, size_t len)
+{
+	size_t pos = 0;
+
+	// Reads byte by byte to never consume data past the newline. Replies are short, so it's cheap enough.
+	while (pos < len - 1) {
+		char c;
+		ssize_t res = read(fd, &c, 1);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		else if (res == 0)
+			break;
+
+		if (c == '\n') {
+			buf[pos] = '\0';
+			return (int)pos;
+		}
+		buf[pos++] = c;
+	}
+
+	buf[pos] = '\0';
+	return (pos > 0) ? -1 : 0; // Line is too long or connection closed in the middle of it
+}
+
+error_t dl_ipc_request(int fd, uint16_t remote_id, uint8_t btn_id, uint8_t repeats, bool use_old_alg, char* reply, size_t len)
+{
+	char line[DL_IPC_LINE_MAX];
+	int n;
+
+	if (repeats)
+		n = snprintf(line, sizeof(line), "%u %u %u%s\n", remote_id, btn_id, repeats, use_old_alg ? " old" : "");
+	else
+		n = snprintf(line, sizeof(line), "%u %u%s\n", remote_id, btn_id, use_old_alg ? " old" : "");
+	if (dl_ipc_write(fd, line, (size_t)n) < 0)
+		return -1;
+
+	if (dl_ipc_readline(fd, reply, len) <= 0)
+		return -1;
+
+	return (strncmp(reply, "OK", 2) == 0) ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __ipc_h__
+#define __ipc_h__
+
+#include <sys/types.h>
+
+#ifndef __error_t_defined
+typedef int error_t;
+#define __error_t_defined
+#endif
+
+/// @brief Default path of the digilivolod Unix-domain socket.
+#define DL_IPC_SOCKET_PATH "/tmp/digilivolod.sock"
+
+/// @brief Maximum length of one request or reply line, including the newline.
+#define DL_IPC_LINE_MAX 128
+
+/// @brief Creates a listening Unix-domain socket, removing a stale socket file if present.
+///        Fails with EADDRINUSE if another daemon listens on it.
+/// @param path[in] filesystem path of the socket
+/// @param ino[out] inode of the socket file, for dl_ipc_unlink()
+/// @return listening socket file descriptor or -1 on error (errno is set)
+extern int dl_ipc_listen(const char* path, ino_t* ino);
+
+/// @brief Removes the socket file if it's still the one created by dl_ipc_listen().
+/// @param path[in] filesystem path of the socket
+/// @param ino[in] inode returned by dl_ipc_listen()
+extern void dl_ipc_unlink(const char* path, ino_t ino);
+
+/// @brief Connects to the digilivolod socket.
+/// @param path[in] filesystem path of the socket
+/// @return connected socket file descriptor or -1 on error (errno is set)
+extern int dl_ipc_connect(const char* path);
+
+/// @brief Writes the whole buffer to the socket, retrying on short writes.
+/// @param fd[in] socket file descriptor
+/// @param buf[in] data to write
+/// @param len[in] data length
+/// @return 0 on success, -1 on error
+extern error_t dl_ipc_write(int fd, const char* buf, size_t len);
+
+/// @brief Reads one newline terminated line from the socket. Newline is stripped.
+/// @param fd[in] socket file descriptor
+/// @param buf[out] buffer for the line
+/// @param len[in] buffer size, should be at least DL_IPC_LINE_MAX
+/// @return line length, 0 on EOF or -1 on error
+extern int dl_ipc_readline(int fd, char* buf, size_t len);
+
+/// @brief Sends one switch command to the daemon and waits for its reply.
+/// @param fd[in] connected socket file descriptor
+/// @param remote_id[in] Livolo Remote ID to send
+/// @param btn_id[in] Livolo Keycode to send
+/// @param repeats[in] frame repeats after the first one, 0 - device default
+/// @param use_old_alg[in] use CMD_SWITCH_OLD transmit method
+/// @param reply[out] buffer for the reply line ("OK ..." or "ERR ...")
+/// @param len[in] reply buffer size
+/// @return 0 if daemon replied with OK, 1 if it replied with ERR, -1 on IPC error
+extern error_t dl_ipc_request(int fd, uint16_t remote_id, uint8_t btn_id, uint8_t repeats, bool use_old_alg, char* reply, size_t len);
+
+#endif // __ipc_h__
@@ -0,0 +1,485 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* libdigilivolo public API (digilivolo.h) over usb_func.c & batch.c. Same send & ACK matching
+ * as dl_batch_run(), split into non-blocking steps: digilivolo_submit() queues & sends what
+ * the device can take, digilivolo_process() collects the replies & completes the commands. */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defs.h"
+#include "dl_time.h"
+#include "git_version.h"
+
+#include <hidapi.h>
+#include "transport.h"
+#include "usb_func.h"
+#include "batch.h"
+#include "digilivolo.h"
+
+_Static_assert(DIGILIVOLO_OK == DLUSB_OK && DIGILIVOLO_ERR_SEND == DLUSB_ERR_SEND && \
+	DIGILIVOLO_ERR_REPLY == DLUSB_ERR_REPLY && DIGILIVOLO_ERR_TIMEOUT == DLUSB_ERR_TIMEOUT && \
+	DIGILIVOLO_ERR_STATUS == DLUSB_ERR_STATUS, "DIGILIVOLO_ERR_* should match DLUSB_ERR_*");
+
+// Command IDs are returned as long, which is 32 bit on some platforms
+#define LIB_ID_MAX 0x7FFFFFFF
+
+/// @brief Completion callback of a queued command.
+typedef struct lib_cb {
+	uint32_t id;
+	digilivolo_cb_t cb;
+	void* user_data;
+} lib_cb_t;
+
+struct digilivolo {
+	dl_device_t* dev;
+	bool verbose;
+	dl_batch_t batch; // Commands: [head, next) are in flight, [next, count) aren't sent yet
+	lib_cb_t* cbs; // Callbacks, same indexes as batch.cmds
+	size_t cbs_size;
+	size_t head, next;
+	size_t credits; // Commands device queue can take, known from the status report
+	size_t failed;
+	uint64_t t_progress; // Last ACK or send to the idle device, head timeout counts from it
+	uint32_t next_id;
+	int processing; // Inside digilivolo_process(), indexes must stay put
+	bool closing; // Commands added from the callbacks are rejected
+};
+
+// hid_init() & hid_exit() are called for the first & last handle
+static int lib_users = 0;
+
+/// @brief Removes completed commands from the queue start.
+static void compact(digilivolo_t* dl)
+{
+	if (dl->processing || dl->head == 0)
+		return;
+
+	size_t left = dl->batch.count - dl->head;
+	memmove(dl->batch.cmds, dl->batch.cmds + dl->head, left * sizeof(dl_cmd_t));
+	memmove(dl->cbs, dl->cbs + dl->head, left * sizeof(lib_cb_t));
+	dl->batch.count = left;
+	dl->next -= dl->head;
+	dl->head = 0;
+}
+
+/// @brief Queues a command.
+/// @return command ID or DIGILIVOLO_ERR_* code
+static long add(digilivolo_t* dl, const digilivolo_cmd_t* cmd, digilivolo_cb_t cb, void* user_data)
+{
+	bool old_alg = (cmd->flags & DIGILIVOLO_CMD_OLD) && dl->dev->release_number >= 0x200;
+
+	if (cmd->remote_id == 0 || cmd->key_code == 0)
+		return DIGILIVOLO_ERR_ARG;
+	if (dl->closing)
+		return DIGILIVOLO_ERR_CANCELLED;
+
+	// Keep the queue from growing while the completed commands are at its start
+	if (dl->head >= dl->batch.count / 2)
+		compact(dl);
+
+	if (dl_batch_add(&dl->batch, cmd->remote_id, cmd->key_code, cmd->repeats, old_alg) < 0)
+		return DIGILIVOLO_ERR_NOMEM;
+
+	if (dl->cbs_size < dl->batch.size) {
+		lib_cb_t* cbs = realloc(dl->cbs, dl->batch.size * sizeof(lib_cb_t));
+		if (!cbs) {
+			dl->batch.count--;
+			return DIGILIVOLO_ERR_NOMEM;
+		}
+		dl->cbs = cbs;
+		dl->cbs_size = dl->batch.size;
+	}
+
+	lib_cb_t* lcb = &dl->cbs[dl->batch.count - 1];
+	lcb->id = dl->next_id;
+	lcb->cb = cb;
+	lcb->user_data = user_data;
+	dl->next_id = (dl->next_id == LIB_ID_MAX) ? 1 : dl->next_id + 1;
+
+	return (long)lcb->id;
+}
+
+/// @brief Completes the head command & calls its callback.
+static void complete_head(digilivolo_t* dl, int status)
+{
+	dl_cmd_t* cmd = &dl->batch.cmds[dl->head];
+	lib_cb_t lcb = dl->cbs[dl->head];
+	digilivolo_result_t result;
+
+	cmd->status = status;
+	cmd->t_done = dl_time_us();
+	if (status != DIGILIVOLO_OK)
+		dl->failed++;
+
+	memset(&result, 0, sizeof(result));
+	result.id = lcb.id;
+	result.status = status;
+	result.remote_id = cmd->remote_id;
+	result.key_code = cmd->btn_id;
+	result.latency_us = cmd->t_sent ? (uint32_t)(cmd->t_done - cmd->t_sent) : 0;
+
+	// Callback may add commands, moving the arrays
+	dl->head++;
+	if (dl->next < dl->head)
+		dl->next = dl->head;
+	if (lcb.cb)
+		lcb.cb(dl, &result, lcb.user_data);
+}
+
+/// @brief Sends queued commands while the device queue has room.
+/// @param fail[in] complete commands which can't be sent with nothing in flight with DIGILIVOLO_ERR_SEND
+/// @return number of commands completed
+static int send_pending(digilivolo_t* dl, bool fail)
+{
+	dlusb_status_packet_t status;
+	bool flow = dlusb_has_status(dl->dev);
+	int done = 0;
+
+	while (dl->next < dl->batch.count && (flow || dl->next - dl->head < DL_BATCH_WINDOW)) {
+		if (flow && dl->credits == 0 && dlusb_get_status(&status, dl->dev) >= 0)
+			dl->credits = status.rx_free;
+
+		// Device queue is full, wait for some ACKs. Nothing in flight - try anyway.
+		if (flow && dl->credits == 0 && dl->next > dl->head)
+			break;
+
+		size_t limit = flow ? (dl->credits ? dl->credits : 1) : DL_BATCH_WINDOW - (dl->next - dl->head);
+		dl_cmd_t* cmds = dl->batch.cmds;
+		size_t count = 1;
+		if (dlusb_has_multi(dl->dev)) {
+			while (count < DL_MULTI_MAX && count < limit && dl->next + count < dl->batch.count && \
+				cmds[dl->next + count].repeats == cmds[dl->next].repeats)
+				count++;
+		}
+
+		if (dl->next == dl->head)
+			dl->t_progress = dl_time_us();
+
+		if (dl_batch_send_group(&cmds[dl->next], count, dl->dev) < 0) {
+			// Device queue is probably full, wait for some ACKs before retrying
+			if (dl->next > dl->head || !fail)
+				break;
+
+			// Nothing in flight, so it's a real error
+			if (dl->verbose)
+				printf("WARN: (%d) Unable to send a feature report: %ls\n", DLUSB_ERR_SEND, dl_error(dl->dev));
+			for (size_t i = 0; i < count; i++)
+				complete_head(dl, DIGILIVOLO_ERR_SEND);
+			done += (int)count;
+			continue;
+		}
+
+		dl->next += count;
+		dl->credits = (dl->credits > count) ? dl->credits - count : 0;
+	}
+
+	return done;
+}
+
+/// @brief Deadline of the oldest command group in flight, as in dl_batch_run().
+static uint64_t head_deadline(const digilivolo_t* dl)
+{
+	size_t count = dl_batch_group_size(&dl->batch, dl->head, dl->next);
+
+	return dl->t_progress + (DLUSB_ACK_TIMEOUT_MS + (uint64_t)(count - 1) * DLUSB_TX_DURATION_MS) * 1000;
+}
+
+/// @brief Matches device reply to the commands in flight & completes them.
+/// @return number of commands completed
+static int handle_packet(digilivolo_t* dl, const dlusb_packet_t* packet)
+{
+	size_t match;
+	int done = 0;
+
+	/* Tagged replies are matched by seq number. Untagged ones from the older firmware
+	 * by content. Replies arrive in order, so commands before the matching one have
+	 * been lost. Stale reports & RDY packet don't match anything and are skipped. */
+	for (match = dl->head; match < dl->next; match++) {
+		dl_cmd_t* cmd = &dl->batch.cmds[match];
+		if (packet->seq != 0 ? packet->seq == cmd->seq : dlusb_is_ack(packet, cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->seq))
+			break;
+	}
+
+	if (match == dl->next) {
+		if (dl->verbose)
+			printf("Skipping stale report from device (CMD ID 0x%02x, seq %u).\n", packet->cmd_id, packet->seq);
+		return 0;
+	}
+
+	// Match is an index, callbacks may only append commands
+	while (dl->head < match) {
+		complete_head(dl, DIGILIVOLO_ERR_REPLY);
+		done++;
+	}
+
+	size_t count = dl_batch_group_size(&dl->batch, dl->head, dl->next);
+	bool ok;
+	if (count > 1)
+		ok = dlusb_is_multi_ack(packet, dl->batch.cmds[dl->head].seq);
+	else {
+		dl_cmd_t* cmd = &dl->batch.cmds[dl->head];
+		ok = dlusb_is_ack(packet, cmd->remote_id, cmd->btn_id, cmd->old_alg, cmd->seq);
+	}
+
+	dl->t_progress = dl_time_us();
+	for (size_t i = 0; i < count; i++)
+		complete_head(dl, ok ? DIGILIVOLO_OK : (packet->status != DL_STATUS_OK ? DIGILIVOLO_ERR_STATUS : DIGILIVOLO_ERR_REPLY));
+
+	return done + (int)count;
+}
+
+const char* digilivolo_version(void)
+{
+	return GIT_VERSION;
+}
+
+digilivolo_t* digilivolo_open(const char* transport, unsigned int flags)
+{
+	bool verbose = (flags & DIGILIVOLO_OPEN_VERBOSE) != 0;
+
+	if (transport && !dl_transport_valid(transport))
+		return NULL;
+
+	digilivolo_t* dl = calloc(1, sizeof(*dl));
+	if (!dl)
+		return NULL;
+
+	if (lib_users++ == 0 && hid_init()) {
+		lib_users--;
+		free(dl);
+		return NULL;
+	}
+
+	dl->dev = dlusb_open(transport, verbose);
+	if (!dl->dev) {
+		if (--lib_users == 0)
+			hid_exit();
+		free(dl);
+		return NULL;
+	}
+
+	dl->verbose = verbose;
+	dl->next_id = 1;
+	return dl;
+}
+
+void digilivolo_close(digilivolo_t* dl)
+{
+	if (!dl)
+		return;
+
+	// Callbacks can't add commands anymore, pending ones are dropped
+	dl->processing++;
+	dl->closing = true;
+	while (dl->head < dl->batch.count)
+		complete_head(dl, DIGILIVOLO_ERR_CANCELLED);
+
+	dl_close(dl->dev);
+	dl_batch_free(&dl->batch);
+	free(dl->cbs);
+	free(dl);
+
+	if (--lib_users == 0)
+		hid_exit();
+}
+
+unsigned int digilivolo_fw_version(const digilivolo_t* dl)
+{
+	return dl ? dl->dev->release_number : 0;
+}
+
+long digilivolo_submit(digilivolo_t* dl, const digilivolo_cmd_t* cmd, digilivolo_cb_t cb, void* user_data)
+{
+	return digilivolo_submit_batch(dl, cmd, 1, cb, user_data);
+}
+
+long digilivolo_submit_batch(digilivolo_t* dl, const digilivolo_cmd_t* cmds, size_t count, digilivolo_cb_t cb, void* user_data)
+{
+	long first = 0;
+
+	if (!dl || !cmds || count == 0)
+		return DIGILIVOLO_ERR_ARG;
+
+	for (size_t i = 0; i < count; i++) {
+		if (cmds[i].remote_id == 0 || cmds[i].key_code == 0)
+			return DIGILIVOLO_ERR_ARG;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		long id = add(dl, &cmds[i], cb, user_data);
+		if (id < 0) {
+			// Drop the part of the batch queued, it hasn't been sent yet
+			dl->batch.count -= i;
+			return id;
+		}
+		if (i == 0)
+			first = id;
+	}
+
+	// Completions are only reported from digilivolo_process(), failed sends are retried there
+	if (!dl->processing)
+		send_pending(dl, false);
+
+	return first;
+}
+
+int digilivolo_process(digilivolo_t* dl, int timeout_ms)
+{
+	dlusb_packet_t packet;
+	int done;
+
+	if (!dl)
+		return DIGILIVOLO_ERR_ARG;
+
+	dl->processing++;
+
+	done = send_pending(dl, true);
+	if (dl->head < dl->next) {
+		uint64_t deadline = head_deadline(dl);
+		uint64_t now = dl_time_us();
+
+		if (now >= deadline) {
+			if (dl->verbose)
+				printf("WARN: No ACK from device, %zu commands in flight.\n", dl->next - dl->head);
+			while (dl->head < dl->next) {
+				complete_head(dl, DIGILIVOLO_ERR_TIMEOUT);
+				done++;
+			}
+		}
+		else {
+			// Don't wait past the head deadline
+			uint64_t left_ms = (deadline - now + 999) / 1000;
+			uint32_t wait_ms = (timeout_ms < 0) ? 0 : (uint32_t)timeout_ms;
+			if (wait_ms > left_ms)
+				wait_ms = (uint32_t)left_ms;
+
+			if (dlusb_wait_packet(&packet, dl->dev, wait_ms) > 0)
+				done += handle_packet(dl, &packet);
+		}
+
+		// ACKs make room in the device queue
+		done += send_pending(dl, true);
+	}
+
+	dl->processing--;
+	return done;
+}
+
+int digilivolo_wait(digilivolo_t* dl)
+{
+	if (!dl)
+		return DIGILIVOLO_ERR_ARG;
+
+	size_t failed = dl->failed;
+	while (dl->head < dl->batch.count)
+		digilivolo_process(dl, DLUSB_ACK_TIMEOUT_MS);
+
+	return (int)(dl->failed - failed);
+}
+
+size_t digilivolo_pending(const digilivolo_t* dl)
+{
+	return dl ? dl->batch.count - dl->head : 0;
+}
+
+int digilivolo_get_fd(const digilivolo_t* dl)
+{
+	// Replies come as input reports only from the firmware which pushes them
+	if (!dl || !dl->dev->caps.intr)
+		return -1;
+
+	return dl_poll_fd(dl->dev);
+}
+
+int digilivolo_get_timeout(const digilivolo_t* dl)
+{
+	if (!dl || dl->head == dl->batch.count)
+		return -1;
+
+	// Commands waiting to be sent with nothing in flight
+	if (dl->head == dl->next)
+		return 0;
+
+	uint64_t deadline = head_deadline(dl);
+	uint64_t now = dl_time_us();
+	if (now >= deadline)
+		return 0;
+
+	uint64_t left_ms = (deadline - now + 999) / 1000;
+	// Without the file descriptor device has to be polled
+	if (digilivolo_get_fd(dl) < 0 && left_ms > DLUSB_ACK_POLL_MIN_MS)
+		left_ms = DLUSB_ACK_POLL_MIN_MS;
+
+	return (int)left_ms;
+}
+
+/// @brief digilivolo_switch() completion state.
+typedef struct switch_result {
+	bool done;
+	int status;
+	uint32_t latency_us;
+} switch_result_t;
+
+static void switch_cb(digilivolo_t* dl, const digilivolo_result_t* result, void* user_data)
+{
+	switch_result_t* res = user_data;
+
+	(void)dl;
+	res->done = true;
+	res->status = result->status;
+	res->latency_us = result->latency_us;
+}
+
+int digilivolo_switch(digilivolo_t* dl, uint16_t remote_id, uint8_t key_code, uint32_t* latency_us)
+{
+	digilivolo_cmd_t cmd = { .remote_id = remote_id, .key_code = key_code };
+	switch_result_t res = { false, DIGILIVOLO_OK, 0 };
+	long id = digilivolo_submit(dl, &cmd, switch_cb, &res);
+
+	if (id < 0)
+		return (int)id;
+
+	while (!res.done)
+		digilivolo_process(dl, DLUSB_ACK_TIMEOUT_MS);
+
+	if (latency_us)
+		*latency_us = res.latency_us;
+	return res.status;
+}
+
+const char* digilivolo_strerror(int err)
+{
+	switch (err) {
+	case DIGILIVOLO_ERR_ARG:
+		return "invalid argument";
+	case DIGILIVOLO_ERR_NOMEM:
+		return "out of memory";
+	case DIGILIVOLO_ERR_CANCELLED:
+		return "cancelled";
+	default:
+		return dlusb_strerror(err);
+	}
+}
@@ -0,0 +1,172 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "defs.h"
+
+#include <hidapi.h>
+#include "transport.h"
+#include "usb_func.h"
+#include "batch.h"
+#include "scene.h"
+
+/// @brief Parses "scene ID NAME [GAP_MS]" header line into the scene header.
+/// @return true if line was parsed successfully
+static bool parse_header(const char* line, dl_scene_t* scene)
+{
+	char name[DL_SCENE_NAME_LEN + 1];
+	unsigned int id, gap_ms = 0;
+	int fields, end = 0;
+
+	fields = sscanf(line, " scene %u %8s %n%u %n", &id, name, &end, &gap_ms, &end);
+	if (fields < 2 || line[end] != '\0' || id >= DL_SCENE_END || gap_ms > 2550)
+		return false;
+
+	memset(scene, 0, sizeof(*scene));
+	scene->id = (uint8_t)id;
+	// Device counts the gap in 10 ms units, round up
+	scene->gap = (uint8_t)((gap_ms + 9) / 10);
+	memcpy(scene->name, name, strlen(name));
+
+	return true;
+}
+
+error_t dl_scenes_load(dl_scenes_t* scenes, FILE* stream)
+{
+	char line[256];
+	int line_num = 0;
+	size_t pos = 0;
+	dl_scene_t* scene = NULL;
+	dl_tuple_t tuple;
+	uint8_t repeats;
+	bool old_alg;
+
+	memset(scenes->data, DL_SCENE_END, sizeof(scenes->data));
+
+	while (fgets(line, sizeof(line), stream)) {
+		line_num++;
+
+		// Line didn't fit into the buffer
+		if (!strchr(line, '\n') && !feof(stream))
+			return line_num;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		const char* p = line;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (strncmp(p, "scene", 5) == 0) {
+			// Header & the table end marker after it should fit
+			if (pos + sizeof(dl_scene_t) + 1 > DL_SCENES_SIZE)
+				return line_num;
+
+			scene = (dl_scene_t*)&scenes->data[pos];
+			if (!parse_header(p, scene))
+				return line_num;
+			pos += sizeof(dl_scene_t);
+		}
+		else {
+			// Button codes before the first scene header or too many of them
+			if (!scene || scene->count == UINT8_MAX || pos + sizeof(dl_tuple_t) + 1 > DL_SCENES_SIZE)
+				return line_num;
+
+			// Scene codes are sent with the device default repeats, tuples have no room for them
+			if (!dl_parse_cmd(p, &tuple.remote_id, &tuple.btn_id, &repeats, &old_alg) || repeats != 0)
+				return line_num;
+			tuple.flags = old_alg ? DL_TUPLE_FLAG_OLD : 0;
+
+			memcpy(&scenes->data[pos], &tuple, sizeof(tuple));
+			pos += sizeof(dl_tuple_t);
+			scene->count++;
+		}
+	}
+
+	// Table end marker is already there, round up to the whole blocks
+	scenes->size = (pos / DL_DATA_SIZE + 1) * DL_DATA_SIZE;
+	if (scenes->size > DL_SCENES_SIZE)
+		scenes->size = DL_SCENES_SIZE;
+
+	return 0;
+}
+
+error_t dl_scenes_upload(const dl_scenes_t* scenes, dl_device_t* handle, bool verbose)
+{
+	dlusb_packet_t packet;
+
+	for (size_t offset = 0; offset < scenes->size; offset += DL_DATA_SIZE) {
+		uint8_t seq = dlusb_next_seq();
+
+		if (dlusb_send_data(CMD_SCENE_WRITE, (uint16_t)offset, &scenes->data[offset], seq, handle) < 0)
+			return DLUSB_ERR_SEND;
+
+		// Device writes the block to EEPROM before the reply, ~3.4 ms per changed byte
+		if (dlusb_wait_reply(&packet, seq, handle, DLUSB_ACK_TIMEOUT_MS, verbose) != DLUSB_OK)
+			return DLUSB_ERR_TIMEOUT;
+
+		if (packet.status != DL_STATUS_OK)
+			return DLUSB_ERR_STATUS;
+		else if (packet.cmd_id != CMD_SCENE_WRITE || packet.remote_id != offset)
+			return DLUSB_ERR_REPLY;
+
+		if (verbose)
+			printf("Scene table: %zu of %zu bytes written.\n", offset + DL_DATA_SIZE, scenes->size);
+	}
+
+	return DLUSB_OK;
+}
+
+error_t dl_scene_play(uint8_t scene_id, dl_device_t* handle, bool verbose)
+{
+	dlusb_packet_t packet;
+	dlusb_status_packet_t status;
+	uint8_t seq = dlusb_next_seq();
+	error_t res;
+
+	if (dlusb_send_scene(scene_id, seq, handle) < 0)
+		return DLUSB_ERR_SEND;
+
+	if (verbose)
+		printf("Scene %u sent to device. Waiting for a reply...\n", scene_id);
+
+	/* Scene length isn't known here, keep waiting while the device reports
+	 * it's still playing. */
+	for (;;) {
+		res = dlusb_wait_reply(&packet, seq, handle, DLUSB_ACK_TIMEOUT_MS, verbose);
+		if (res == DLUSB_OK)
+			break;
+		else if (!dlusb_has_status(handle) || dlusb_get_status(&status, handle) < 0 || !(status.flags & DL_STATE_SCENE))
+			return res;
+	}
+
+	if (packet.status != DL_STATUS_OK)
+		return DLUSB_ERR_STATUS;
+	else if (packet.cmd_id != CMD_SCENE || packet.btn_id != scene_id)
+		return DLUSB_ERR_REPLY;
+
+	return DLUSB_OK;
+}
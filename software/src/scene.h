@@ -0,0 +1,65 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __scene_h__
+#define __scene_h__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "transport.h"
+
+#include "defs.h"
+
+#ifndef __error_t_defined
+typedef int error_t;
+#define __error_t_defined
+#endif
+
+/// @brief Scene table image, as stored in the device EEPROM.
+typedef struct dl_scenes {
+    uint8_t data[DL_SCENES_SIZE];
+    size_t size; // Bytes to upload, whole DL_DATA_SIZE blocks including the table end marker
+} dl_scenes_t;
+
+/// @brief Reads scenes from a stream & builds the scene table. Each scene starts with
+///        "scene ID NAME [GAP_MS]" line, followed by its "REMOTE_ID KEY_CODE [old]" lines.
+///        Empty lines and lines starting with '#' are ignored.
+/// @param scenes[out] scene table
+/// @param stream[in] stream to read from
+/// @return 0 on success, line number of the first malformed line or the line which doesn't fit in the table
+extern error_t dl_scenes_load(dl_scenes_t* scenes, FILE* stream);
+
+/// @brief Writes scene table to the device EEPROM, one REPORT_ID_DATA block at a time.
+/// @param scenes[in] scene table
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @return DLUSB_OK on success or DLUSB_ERR_* code
+extern error_t dl_scenes_upload(const dl_scenes_t* scenes, dl_device_t* handle, bool verbose);
+
+/// @brief Plays scene stored in the device & waits until all its button codes has been sent.
+///        Waiting goes on past the usual ACK timeout while the device reports the scene playing.
+/// @param scene_id[in] scene ID
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @return DLUSB_OK on success or DLUSB_ERR_* code
+extern error_t dl_scene_play(uint8_t scene_id, dl_device_t* handle, bool verbose);
+
+#endif // __scene_h__
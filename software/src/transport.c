@@ -0,0 +1,116 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "transport.h"
+
+const dl_transport_t* const dl_transports[] = {
+	&dl_transport_hidapi,
+#ifdef DL_TRANSPORT_HIDRAW
+	&dl_transport_hidraw,
+#endif
+#ifdef DL_TRANSPORT_LIBUSB
+	&dl_transport_libusb,
+#endif
+	&dl_transport_emu,
+	NULL
+};
+
+/// @brief Finds transport by the name part of spec.
+/// @param spec[in] "NAME[:ARGS]"
+/// @param args[out] pointer to ARGS in spec or NULL if there are none
+/// @return transport or NULL if there's no such transport
+static const dl_transport_t* find_transport(const char* spec, const char** args)
+{
+	const char* sep = strchr(spec, DL_TRANSPORT_SEP);
+	size_t len = sep ? (size_t)(sep - spec) : strlen(spec);
+
+	*args = sep ? sep + 1 : NULL;
+	for (size_t i = 0; dl_transports[i]; i++) {
+		if (strlen(dl_transports[i]->name) == len && strncmp(dl_transports[i]->name, spec, len) == 0)
+			return dl_transports[i];
+	}
+
+	return NULL;
+}
+
+dl_device_t* dl_transport_open(const char* spec, bool verbose)
+{
+	const dl_transport_t* transport = dl_transports[0];
+	const char* args = NULL;
+
+	if (spec) {
+		transport = find_transport(spec, &args);
+		if (!transport) {
+			if (DL_PRINT_ERRORS(verbose))
+				printf("ERROR: unknown transport %s\n", spec);
+			return NULL;
+		}
+	}
+
+	if (verbose)
+		printf("Using %s transport (%s).\n", transport->name, transport->description);
+
+	dl_device_t* dev = transport->open(args, verbose);
+	if (dev)
+		dev->verbose = verbose;
+
+	return dev;
+}
+
+bool dl_transport_valid(const char* spec)
+{
+	const char* args;
+
+	return find_transport(spec, &args) != NULL;
+}
+
+void dl_close(dl_device_t* dev)
+{
+	dev->transport->close(dev);
+}
+
+int dl_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length)
+{
+	return dev->transport->send_feature_report(dev, data, length);
+}
+
+int dl_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length)
+{
+	return dev->transport->get_feature_report(dev, data, length);
+}
+
+int dl_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	return dev->transport->read_timeout(dev, data, length, milliseconds);
+}
+
+int dl_poll_fd(dl_device_t* dev)
+{
+	return dev->transport->poll_fd ? dev->transport->poll_fd(dev) : -1;
+}
+
+const wchar_t* dl_error(dl_device_t* dev)
+{
+	return dev->transport->error(dev);
+}
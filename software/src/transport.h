@@ -0,0 +1,134 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef __transport_h__
+#define __transport_h__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <wchar.h>
+
+/* Transports are selected with "NAME[:ARGS]" spec, ARGS are passed to the backend as is.
+ * First one in the list is the default. */
+#define DL_TRANSPORT_SEP ':'
+
+/* Errors & warnings are printed on stdout, except when built into libdigilivolo, which
+ * returns result codes & prints them only if opened with DIGILIVOLO_OPEN_VERBOSE. */
+#ifdef DIGILIVOLO_BUILD
+#define DL_PRINT_ERRORS(verbose) (verbose)
+#else
+#define DL_PRINT_ERRORS(verbose) true
+#endif
+
+typedef struct dl_device dl_device_t;
+
+/// @brief Device transport backend. Report operations follow hidapi semantics: report ID
+///        in the first byte, number of bytes transferred or -1 on error returned.
+typedef struct dl_transport {
+	const char* name;
+	const char* description; // One line for the help & transport list
+	/// @brief Opens DigiLivolo device.
+	/// @param args[in] backend arguments from the transport spec, NULL if none
+	/// @param verbose[in] print diagnostic messages
+	/// @return opened device with transport & release_number set or NULL on failure
+	dl_device_t* (*open)(const char* args, bool verbose);
+	void (*close)(dl_device_t* dev);
+	int (*send_feature_report)(dl_device_t* dev, const unsigned char* data, size_t length);
+	int (*get_feature_report)(dl_device_t* dev, unsigned char* data, size_t length);
+	/// @brief Reads interrupt IN (input) report, 0 if none arrived before timeout.
+	int (*read_timeout)(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds);
+	/// @brief Returns file descriptor which becomes readable when an input report arrives,
+	///        so many devices can be waited for in one poll/epoll loop. Optional, may be NULL.
+	int (*poll_fd)(dl_device_t* dev);
+	/// @brief Returns description of the last error, never NULL.
+	const wchar_t* (*error)(dl_device_t* dev);
+} dl_transport_t;
+
+/// @brief Firmware capabilities of the opened device & protocol options, set by dlusb_open().
+typedef struct dl_caps {
+	/* Device supports DL_FLAG_INTR, replies are read from the interrupt IN endpoint
+	 * instead of polling the feature report. Cleared if the transport can't read them. */
+	bool intr;
+	bool multi; // Accepts REPORT_ID_MULTI reports
+	bool status; // Returns REPORT_ID_STATUS report
+	bool scenes; // Accepts CMD_SCENE & REPORT_ID_DATA reports
+	bool timing; // Has RF timing profile
+	bool repeats; // Takes frame repeats from the commands
+	bool stats; // Returns REPORT_ID_STATS report
+	bool times; // Sends CMD_TIMES reports
+	bool times_on; // Switch commands are sent with DL_FLAG_TIMES, set by dlusb_request_times()
+} dl_caps_t;
+
+/// @brief Opened device.
+struct dl_device {
+	const dl_transport_t* transport;
+	void* priv; // Backend state, i.e. hid_device*
+	unsigned short release_number; // Firmware version (USB bcdDevice)
+	bool verbose; // Opened with verbose, for the messages of the calls without it
+	dl_caps_t caps;
+};
+
+// Backends
+extern const dl_transport_t dl_transport_hidapi;
+extern const dl_transport_t dl_transport_emu;
+#ifdef DL_TRANSPORT_HIDRAW
+extern const dl_transport_t dl_transport_hidraw;
+#endif
+#ifdef DL_TRANSPORT_LIBUSB
+extern const dl_transport_t dl_transport_libusb;
+#endif
+
+// NULL terminated list of the backends built in
+extern const dl_transport_t* const dl_transports[];
+
+/// @brief Opens DigiLivolo device via the transport selected by spec.
+/// @param spec[in] "NAME[:ARGS]" or NULL for the default transport
+/// @param verbose[in] print diagnostic messages
+/// @return opened device or NULL on failure or unknown transport name
+extern dl_device_t* dl_transport_open(const char* spec, bool verbose);
+
+/// @brief Checks if spec names one of the built in transports.
+/// @param spec[in] "NAME[:ARGS]"
+/// @return true if the transport exists
+extern bool dl_transport_valid(const char* spec);
+
+/// @brief Closes the device & frees it.
+extern void dl_close(dl_device_t* dev);
+
+/// @brief Sends a Feature Report to the device.
+/// @return Bytes sent or -1 on error
+extern int dl_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length);
+
+/// @brief Reads a Feature Report with report ID set in data[0].
+/// @return Bytes read including report ID, 0 if device has nothing to report, -1 on error
+extern int dl_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length);
+
+/// @brief Reads an interrupt IN report, waiting up to milliseconds for it.
+/// @return Bytes read, 0 on timeout or -1 on error
+extern int dl_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds);
+
+/// @brief Returns file descriptor to wait for the input reports on with poll/epoll.
+/// @return file descriptor or -1 if the transport doesn't have one
+extern int dl_poll_fd(dl_device_t* dev);
+
+/// @brief Returns description of the last error on the device.
+extern const wchar_t* dl_error(dl_device_t* dev);
+
+#endif // __transport_h__
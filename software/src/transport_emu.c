@@ -0,0 +1,676 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* In-process DigiLivolo device emulator. Follows the firmware: commands go to the rx_buffer
+ * ring & are taken by the main loop while the transmitter queue has room, replies go to the
+ * tx_buffer ring & are read with feature reports or pushed as interrupt IN reports. Button
+ * codes take the airtime of the real frames with the RF timing profile in effect, so the host
+ * sees the same flow control & delays. Scene table is kept in memory & written at once, scenes
+ * are played between the host commands as the firmware does. Emulated time advances lazily,
+ * on each call from the host. */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "defs.h"
+#include "dl_time.h"
+#include "transport.h"
+
+// Firmware version reported by the emulator, with all the features of the current protocol
+#define EMU_RELEASE 0x0300
+
+// Queue depths, as DLUSB_RX_QUEUE_SIZE, DLUSB_TX_QUEUE_SIZE & DLTRANSMIT_QUEUE_SIZE in the firmware
+#define EMU_RX_QUEUE 16
+#define EMU_TX_QUEUE 8
+#define EMU_AIR_QUEUE 2
+
+// Firmware internal flags of the commands from the multi command report (DLUSB_FLAG_*)
+#define EMU_FLAG_MULTI 0x40
+#define EMU_FLAG_MULTI_LAST 0x20
+
+// Default RF timing profile, as the firmware reads it back: pulse widths are rounded to its Timer ticks
+#define EMU_START_US 496
+#define EMU_BIT_US 320
+#define EMU_HALF_US 161
+#define EMU_REPEATS 128
+#define EMU_GAP_MS 100
+/* Longest pulse firmware Timer can time (256 ticks, 496 us read back) & longest pause it accepts.
+ * Longer start pulse is cut to it, longer bit pulses are rejected. */
+#define EMU_PULSE_MAX_US 497
+#define EMU_GAP_MAX_MS 10000
+
+// Frames sent by the original Livolo lib method (DL_LIVOLO_FRAMES)
+#define EMU_OLD_FRAMES 181
+
+// Livolo frame: 16 bits of the Remote ID & 7 bits of the Key code
+#define EMU_FRAME_BITS 23
+
+// Max emulator speed-up factor
+#define EMU_SPEED_MAX 1000
+
+/// @brief Button code in the transmitter queue.
+typedef struct emu_burst {
+	dlusb_packet_t cmd; // Command, turned into the ACK when done
+	uint64_t received; // dl_time_us() timestamps: command taken from rx_buffer, transmit start & end
+	uint64_t start;
+	uint64_t end;
+	uint32_t frames;
+	bool scene; // Code of the playing scene, not ACKed
+} emu_burst_t;
+
+/// @brief Playing scene, as DLScenes in the firmware.
+typedef struct emu_scene {
+	bool active;
+	bool in_flight; // Code is in the transmitter queue
+	dlusb_packet_t cmd; // CMD_SCENE command, ACKed when all codes are sent
+	uint16_t pos; // Next code offset in the scene table
+	uint8_t left;
+	uint64_t gap_us; // Pause after the previous code of the scene, emulated time
+	uint64_t last_sent;
+} emu_scene_t;
+
+/// @brief Emulated device state.
+typedef struct emu {
+	uint32_t speed; // Time runs this many times faster than on the real device
+	dlusb_packet_t rx[EMU_RX_QUEUE];
+	uint8_t rx_head, rx_tail; // Free running, as dlusb_ring indexes
+	dlusb_packet_t tx[EMU_TX_QUEUE];
+	uint8_t tx_head, tx_tail;
+	emu_burst_t air[EMU_AIR_QUEUE]; // Transmitter queue, the first one is on air or waits for the pause to pass
+	uint8_t air_count;
+	uint64_t clock; // Emulated up to this time, dl_time_us()
+	uint64_t idle_since; // End of the last burst, 0 if there was none
+	bool intr; // Host asked for the interrupt IN reports (DL_FLAG_INTR)
+	dl_timing_t timing;
+	dlusb_stats_packet_t stats; // Counters, airtime_ms are set from airtime_us on read
+	uint64_t airtime_us;
+	uint8_t scenes[DL_SCENES_SIZE]; // Scene table, as in the EEPROM
+	emu_scene_t scene;
+	const wchar_t* error;
+} emu_t;
+
+/// @brief Returns transmit time of one frame of the button code with the profile in effect.
+static uint64_t frame_us(const emu_t* emu, uint16_t remote_id, uint8_t btn_id)
+{
+	uint32_t code = ((uint32_t)remote_id << 7) | (btn_id & 0x7F);
+	uint32_t ones = 0;
+
+	for (uint32_t i = 0; i < EMU_FRAME_BITS; i++)
+		ones += (code >> i) & 1;
+
+	// 1 bit is one full pulse, 0 bit are two half ones
+	return (emu->timing.start_us + ones * emu->timing.bit_us + (EMU_FRAME_BITS - ones) * 2 * emu->timing.half_us) / emu->speed;
+}
+
+static void default_timing(emu_t* emu)
+{
+	emu->timing.start_us = EMU_START_US;
+	emu->timing.bit_us = EMU_BIT_US;
+	emu->timing.half_us = EMU_HALF_US;
+	emu->timing.gap_ms = EMU_GAP_MS;
+	emu->timing.repeats = EMU_REPEATS;
+	emu->timing.reserved = 0;
+}
+
+static uint8_t rx_count(const emu_t* emu)
+{
+	return (uint8_t)(emu->rx_head - emu->rx_tail);
+}
+
+static uint8_t tx_count(const emu_t* emu)
+{
+	return (uint8_t)(emu->tx_head - emu->tx_tail);
+}
+
+/// @brief Queues reply for the host, dropped if the queue is full, as DLUSB.write() does.
+static void tx_put(emu_t* emu, const dlusb_packet_t* packet)
+{
+	if (tx_count(emu) == EMU_TX_QUEUE)
+		return;
+
+	emu->tx[emu->tx_head % EMU_TX_QUEUE] = *packet;
+	emu->tx_head++;
+}
+
+static bool tx_get(emu_t* emu, dlusb_packet_t* packet)
+{
+	if (emu->tx_head == emu->tx_tail)
+		return false;
+
+	*packet = emu->tx[emu->tx_tail % EMU_TX_QUEUE];
+	emu->tx_tail++;
+	return true;
+}
+
+/// @brief Sends error reply to the command, as reply_error() in the firmware.
+static void reply_error(emu_t* emu, dlusb_packet_t* packet, uint8_t cmd_id, uint8_t status)
+{
+	packet->cmd_id = cmd_id;
+	packet->status = status;
+	tx_put(emu, packet);
+}
+
+/// @brief Puts button code to the transmitter queue.
+/// @param cmd[in] CMD_SWITCH or CMD_SWITCH_OLD command
+/// @param now[in] emulated time it's queued at
+/// @param scene[in] code of the playing scene
+static void enqueue(emu_t* emu, const dlusb_packet_t* cmd, uint64_t now, bool scene)
+{
+	emu_burst_t* burst = &emu->air[emu->air_count++];
+	burst->cmd = *cmd;
+	burst->received = now;
+	burst->scene = scene;
+	if (cmd->cmd_id == CMD_SWITCH_OLD)
+		burst->frames = EMU_OLD_FRAMES;
+	else
+		burst->frames = (uint32_t)(cmd->repeats ? cmd->repeats : emu->timing.repeats) + 1;
+
+	// Next code waits for the pause after the previous one
+	uint64_t prev_end = (emu->air_count > 1) ? emu->air[emu->air_count - 2].end : emu->idle_since;
+	uint64_t gap_end = prev_end ? prev_end + emu->timing.gap_ms * 1000ULL / emu->speed : 0;
+	burst->start = (gap_end > now) ? gap_end : now;
+	burst->end = burst->start + burst->frames * frame_us(emu, cmd->remote_id, cmd->btn_id);
+}
+
+/// @brief Looks up the scene in the table & starts playing it, as DLScenes::play().
+/// @return false if there's no such scene
+static bool scene_play(emu_t* emu, const dlusb_packet_t* cmd, uint64_t now)
+{
+	uint16_t pos = 0;
+	dl_scene_t scene;
+
+	while (pos + sizeof(dl_scene_t) <= DL_SCENES_SIZE) {
+		memcpy(&scene, &emu->scenes[pos], sizeof(scene));
+		if (scene.id == DL_SCENE_END)
+			break;
+
+		pos += sizeof(dl_scene_t);
+		if (scene.id == cmd->btn_id) {
+			// Truncated scene plays what fits in the table
+			uint16_t fit = (DL_SCENES_SIZE - pos) / sizeof(dl_tuple_t);
+			emu->scene.active = true;
+			emu->scene.in_flight = false;
+			emu->scene.cmd = *cmd;
+			emu->scene.pos = pos;
+			emu->scene.left = (scene.count < fit) ? scene.count : (uint8_t)fit;
+			emu->scene.gap_us = scene.gap * 10000ULL / emu->speed;
+			emu->scene.last_sent = now - emu->scene.gap_us;
+			return true;
+		}
+		pos += scene.count * sizeof(dl_tuple_t);
+	}
+
+	return false;
+}
+
+/// @brief Returns true if next code of the playing scene waits for its pause only.
+static bool scene_waits(const emu_t* emu)
+{
+	return emu->scene.active && !emu->scene.in_flight && emu->scene.left && emu->air_count == 0;
+}
+
+/// @brief Advances playing scene, as scenes_task() in the firmware: queues next code when the
+///        transmitter is idle & the scene pause passed, ACKs the scene when all codes are sent.
+static void scene_task(emu_t* emu, uint64_t now)
+{
+	if (scene_waits(emu) && now - emu->scene.last_sent >= emu->scene.gap_us) {
+		dl_tuple_t tuple;
+		dlusb_packet_t cmd;
+
+		memcpy(&tuple, &emu->scenes[emu->scene.pos], sizeof(tuple));
+		emu->scene.pos += sizeof(tuple);
+		emu->scene.left--;
+		emu->scene.in_flight = true;
+
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.report_id = REPORT_ID;
+		cmd.cmd_id = (tuple.flags & DL_TUPLE_FLAG_OLD) ? CMD_SWITCH_OLD : CMD_SWITCH;
+		cmd.remote_id = tuple.remote_id;
+		cmd.btn_id = tuple.btn_id;
+		enqueue(emu, &cmd, now, true);
+	}
+
+	if (emu->scene.active && !emu->scene.in_flight && emu->scene.left == 0) {
+		emu->scene.active = false;
+		emu->scene.cmd.status = DL_STATUS_OK;
+		tx_put(emu, &emu->scene.cmd);
+	}
+}
+
+/// @brief Takes next command from rx_buffer, as the firmware main loop does.
+/// @param now[in] emulated time it's taken at
+static void take(emu_t* emu, uint64_t now)
+{
+	dlusb_packet_t cmd = emu->rx[emu->rx_tail % EMU_RX_QUEUE];
+	emu->rx_tail++;
+
+	if (cmd.cmd_id == CMD_SWITCH || cmd.cmd_id == CMD_SWITCH_OLD)
+		enqueue(emu, &cmd, now, false);
+	else if (cmd.cmd_id == CMD_SCENE) {
+		// Played between the commands from scene_task(), ACKed when all codes are sent
+		if (emu->scene.active)
+			reply_error(emu, &cmd, CMD_SCENE, DL_STATUS_ERR_BUSY);
+		else if (!scene_play(emu, &cmd, now))
+			reply_error(emu, &cmd, CMD_SCENE, DL_STATUS_ERR_SCENE);
+	}
+	else {
+		emu->stats.unknown++;
+		reply_error(emu, &cmd, CMD_ERR_UNKNOWN, DL_STATUS_ERR_UNKNOWN);
+	}
+}
+
+/// @brief Completes the button code at the transmitter queue head: ACK & CMD_TIMES report
+///        for the host, counters.
+static void complete(emu_t* emu)
+{
+	emu_burst_t burst = emu->air[0];
+	dlusb_packet_t* cmd = &burst.cmd;
+
+	emu->air_count--;
+	memmove(&emu->air[0], &emu->air[1], emu->air_count * sizeof(emu->air[0]));
+
+	emu->idle_since = burst.end;
+	emu->stats.bursts++;
+	emu->stats.frames += burst.frames;
+	emu->airtime_us += burst.end - burst.start;
+
+	if (burst.scene) {
+		emu->scene.in_flight = false;
+		emu->scene.last_sent = burst.end;
+		return;
+	}
+
+	// Commands from the multi command report are ACKed once, after the last one
+	if (cmd->status & EMU_FLAG_MULTI)
+		return;
+	if (cmd->status & EMU_FLAG_MULTI_LAST) {
+		cmd->cmd_id = CMD_SWITCH_MULTI;
+		cmd->remote_id = 0;
+		cmd->btn_id = 0;
+	}
+
+	bool times = (cmd->status & DL_FLAG_TIMES) != 0;
+	cmd->status = DL_STATUS_OK;
+	tx_put(emu, cmd);
+
+	if (times) {
+		dlusb_times_packet_t packet = { 0 };
+		packet.report_id = REPORT_ID;
+		packet.cmd_id = CMD_TIMES;
+		packet.queue_ms = (uint16_t)((burst.start - burst.received) / 1000);
+		packet.seq = cmd->seq;
+		packet.air_ms = (uint16_t)((burst.end - burst.start) / 1000);
+		tx_put(emu, (dlusb_packet_t*)&packet);
+	}
+}
+
+/// @brief Advances emulated device to now, processing events in their time order.
+static void run(emu_t* emu, uint64_t now)
+{
+	for (;;) {
+		// Scene code goes first when the transmitter is idle, as scenes_task() runs before reading commands
+		scene_task(emu, emu->clock);
+
+		// Main loop takes commands while the transmitter can queue them, old method waits for it to be idle
+		while (rx_count(emu) && emu->air_count < EMU_AIR_QUEUE && \
+			!(emu->rx[emu->rx_tail % EMU_RX_QUEUE].cmd_id == CMD_SWITCH_OLD && emu->air_count))
+			take(emu, emu->clock);
+
+		if (emu->air_count && emu->air[0].end <= now) {
+			emu->clock = emu->air[0].end;
+			complete(emu);
+		}
+		else if (scene_waits(emu) && emu->scene.last_sent + emu->scene.gap_us <= now)
+			emu->clock = emu->scene.last_sent + emu->scene.gap_us;
+		else
+			break;
+	}
+
+	emu->clock = now;
+}
+
+/// @brief Queues single command report.
+static int put_single(emu_t* emu, const unsigned char* data, size_t length)
+{
+	dlusb_packet_t packet;
+
+	// Missing trailing bytes are zeroes, as they're sent by the host
+	memset(&packet, 0, sizeof(packet));
+	memcpy(&packet, data, length < sizeof(packet) ? length : sizeof(packet));
+
+	if (rx_count(emu) == EMU_RX_QUEUE) {
+		emu->stats.rx_overflows++;
+		emu->error = L"Device queue is full";
+		return -1;
+	}
+
+	emu->intr = (packet.status & DL_FLAG_INTR) != 0;
+	packet.status &= ~(EMU_FLAG_MULTI | EMU_FLAG_MULTI_LAST);
+	emu->rx[emu->rx_head % EMU_RX_QUEUE] = packet;
+	emu->rx_head++;
+	emu->stats.commands++;
+	return (int)length;
+}
+
+/// @brief Queues all commands from the multi command report or none of them.
+static int put_multi(emu_t* emu, const unsigned char* data, size_t length)
+{
+	dlusb_multi_packet_t multi;
+
+	memset(&multi, 0, sizeof(multi));
+	memcpy(&multi, data, length < sizeof(multi) ? length : sizeof(multi));
+	if (multi.cmd_id != CMD_SWITCH_MULTI || multi.count == 0 || multi.count > DL_MULTI_MAX || \
+		length < offsetof(dlusb_multi_packet_t, tuples) + multi.count * sizeof(dl_tuple_t)) {
+		emu->error = L"Malformed multi command report";
+		return -1;
+	}
+
+	if (EMU_RX_QUEUE - rx_count(emu) < multi.count) {
+		emu->stats.rx_overflows++;
+		emu->error = L"Device queue is full";
+		return -1;
+	}
+
+	emu->intr = (multi.status & DL_FLAG_INTR) != 0;
+	for (uint8_t i = 0; i < multi.count; i++) {
+		dlusb_packet_t* packet = &emu->rx[emu->rx_head % EMU_RX_QUEUE];
+		packet->report_id = REPORT_ID;
+		packet->cmd_id = (multi.tuples[i].flags & DL_TUPLE_FLAG_OLD) ? CMD_SWITCH_OLD : CMD_SWITCH;
+		packet->remote_id = multi.tuples[i].remote_id;
+		packet->btn_id = multi.tuples[i].btn_id;
+		packet->seq = multi.seq;
+		packet->status = (i + 1 == multi.count) ? EMU_FLAG_MULTI_LAST : EMU_FLAG_MULTI;
+		packet->repeats = multi.repeats;
+		emu->rx_head++;
+	}
+
+	emu->stats.commands += multi.count;
+	return (int)length;
+}
+
+/// @brief Processes data report: scene table block or RF timing profile write, other blocks are
+///        unknown commands.
+static int put_data(emu_t* emu, const unsigned char* data, size_t length)
+{
+	dlusb_data_packet_t block;
+	dlusb_packet_t reply;
+
+	if (length < sizeof(block)) {
+		emu->error = L"Short data report";
+		return -1;
+	}
+
+	memcpy(&block, data, sizeof(block));
+	emu->intr = (block.status & DL_FLAG_INTR) != 0;
+	emu->stats.commands++;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.report_id = REPORT_ID;
+	reply.cmd_id = block.cmd_id;
+	reply.remote_id = block.offset;
+	reply.seq = block.seq;
+
+	if (block.cmd_id == CMD_SCENE_WRITE) {
+		if (emu->scene.active)
+			reply_error(emu, &reply, block.cmd_id, DL_STATUS_ERR_BUSY);
+		else if (block.offset > DL_SCENES_SIZE - DL_DATA_SIZE)
+			reply_error(emu, &reply, block.cmd_id, DL_STATUS_ERR_RANGE);
+		else {
+			memcpy(&emu->scenes[block.offset], block.data, DL_DATA_SIZE);
+			reply.status = DL_STATUS_OK;
+			tx_put(emu, &reply);
+		}
+	}
+	else if (block.cmd_id == CMD_TIMING_WRITE) {
+		dl_timing_t timing;
+		memcpy(&timing, block.data, sizeof(timing));
+
+		if (timing.start_us > EMU_PULSE_MAX_US)
+			timing.start_us = EMU_START_US;
+
+		if (timing.repeats == 0)
+			default_timing(emu);
+		else if (timing.start_us == 0 || timing.bit_us == 0 || timing.bit_us > EMU_PULSE_MAX_US || \
+			timing.half_us == 0 || timing.half_us > EMU_PULSE_MAX_US || timing.gap_ms > EMU_GAP_MAX_MS) {
+			reply_error(emu, &reply, block.cmd_id, DL_STATUS_ERR_RANGE);
+			return (int)length;
+		}
+		else
+			emu->timing = timing;
+
+		reply.status = DL_STATUS_OK;
+		tx_put(emu, &reply);
+	}
+	else {
+		emu->stats.unknown++;
+		reply_error(emu, &reply, CMD_ERR_UNKNOWN, DL_STATUS_ERR_UNKNOWN);
+	}
+
+	return (int)length;
+}
+
+static int emu_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length)
+{
+	emu_t* emu = dev->priv;
+	int res;
+
+	if (length < 2) {
+		emu->error = L"Short report";
+		return -1;
+	}
+
+	run(emu, dl_time_us());
+	switch (data[0]) {
+	case REPORT_ID:
+		res = put_single(emu, data, length);
+		break;
+	case REPORT_ID_MULTI:
+		res = put_multi(emu, data, length);
+		break;
+	case REPORT_ID_DATA:
+		res = put_data(emu, data, length);
+		break;
+	default:
+		emu->error = L"Unknown report ID";
+		return -1;
+	}
+
+	// Main loop takes new command right away if the transmitter has room
+	run(emu, dl_time_us());
+	return res;
+}
+
+/// @brief Fills status report, as the firmware does from the USB & transmitter queues state.
+static void fill_status(emu_t* emu, dlusb_status_packet_t* status, uint64_t now)
+{
+	memset(status, 0, sizeof(*status));
+	status->report_id = REPORT_ID_STATUS;
+	status->cmd_id = CMD_STATUS;
+	status->rx_pending = rx_count(emu);
+	status->rx_free = EMU_RX_QUEUE - rx_count(emu);
+	status->reply_free = EMU_TX_QUEUE - tx_count(emu);
+	status->rf_queued = emu->air_count;
+	if (emu->scene.active)
+		status->flags |= DL_STATE_SCENE;
+
+	if (emu->air_count && emu->air[0].start <= now) {
+		const emu_burst_t* burst = &emu->air[0];
+		uint64_t frame = (burst->end - burst->start) / burst->frames;
+		uint64_t sent = frame ? (now - burst->start) / frame : burst->frames;
+
+		status->flags |= DL_STATE_RF_ON_AIR;
+		status->rf_repeats_left = (sent + 1 < burst->frames) ? (uint8_t)(burst->frames - 1 - sent) : 0;
+	}
+}
+
+static int emu_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length)
+{
+	emu_t* emu = dev->priv;
+	uint64_t now = dl_time_us();
+	union {
+		dlusb_packet_t packet;
+		dlusb_status_packet_t status;
+		dlusb_stats_packet_t stats;
+		dlusb_data_packet_t data;
+	} report;
+	size_t size;
+
+	if (length < 1) {
+		emu->error = L"Short report";
+		return -1;
+	}
+
+	run(emu, now);
+	switch (data[0]) {
+	case REPORT_ID:
+		// Nothing to report yet, i.e. still transmitting
+		if (!tx_get(emu, &report.packet))
+			return 0;
+		size = sizeof(report.packet);
+		break;
+	case REPORT_ID_STATUS:
+		fill_status(emu, &report.status, now);
+		size = sizeof(report.status);
+		break;
+	case REPORT_ID_STATS:
+		report.stats = emu->stats;
+		report.stats.report_id = REPORT_ID_STATS;
+		report.stats.cmd_id = CMD_STATS;
+		report.stats.airtime_ms = (uint32_t)(emu->airtime_us / 1000);
+		size = sizeof(report.stats);
+		break;
+	case REPORT_ID_DATA:
+		memset(&report.data, 0, sizeof(report.data));
+		report.data.report_id = REPORT_ID_DATA;
+		report.data.cmd_id = CMD_TIMING;
+		memcpy(report.data.data, &emu->timing, sizeof(emu->timing));
+		size = sizeof(report.data);
+		break;
+	default:
+		emu->error = L"Unknown report ID";
+		return -1;
+	}
+
+	if (size > length)
+		size = length;
+	memcpy(data, &report, size);
+	return (int)size;
+}
+
+static int emu_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	emu_t* emu = dev->priv;
+	uint64_t deadline = dl_time_us() + (milliseconds < 0 ? UINT32_MAX : (uint32_t)milliseconds) * 1000ULL;
+	dlusb_packet_t packet;
+
+	for (;;) {
+		uint64_t now = dl_time_us();
+
+		run(emu, now);
+		// Replies are pushed as input reports only if the host asked for it
+		if (emu->intr && tx_get(emu, &packet)) {
+			size_t size = (length < sizeof(packet)) ? length : sizeof(packet);
+			memcpy(data, &packet, size);
+			return (int)size;
+		}
+
+		if (now >= deadline)
+			return 0;
+
+		// Sleep until the next transmit ends, scene pause passes or timeout passes
+		uint64_t wake = deadline;
+		if (emu->air_count && emu->air[0].end < wake)
+			wake = emu->air[0].end;
+		else if (scene_waits(emu) && emu->scene.last_sent + emu->scene.gap_us < wake)
+			wake = emu->scene.last_sent + emu->scene.gap_us;
+		dl_sleep_ms(wake > now ? (uint32_t)((wake - now + 999) / 1000) : 1);
+	}
+}
+
+static const wchar_t* emu_error(dl_device_t* dev)
+{
+	return ((emu_t*)dev->priv)->error;
+}
+
+static void emu_close(dl_device_t* dev)
+{
+	free(dev->priv);
+	free(dev);
+}
+
+/// @brief Creates emulated device which has just booted, with RDY packet in its queue.
+/// @param args[in] speed-up factor (1-1000), NULL for the real device timing
+static dl_device_t* emu_open(const char* args, bool verbose)
+{
+	unsigned long speed = 1;
+
+	if (args) {
+		char* endptr;
+		speed = strtoul(args, &endptr, 0);
+		if (*endptr != '\0' || speed < 1 || speed > EMU_SPEED_MAX) {
+			if (DL_PRINT_ERRORS(verbose))
+				printf("ERROR: emulator speed-up factor should be 1-%d\n", EMU_SPEED_MAX);
+			return NULL;
+		}
+	}
+
+	dl_device_t* dev = calloc(1, sizeof(*dev));
+	emu_t* emu = calloc(1, sizeof(*emu));
+	if (!dev || !emu) {
+		free(dev);
+		free(emu);
+		return NULL;
+	}
+
+	emu->speed = (uint32_t)speed;
+	emu->clock = dl_time_us();
+	emu->error = L"Success";
+	default_timing(emu);
+	memset(emu->scenes, DL_SCENE_END, sizeof(emu->scenes));
+	emu->stats.usb_resets = 1;
+
+	dlusb_packet_t rdy = { REPORT_ID, CMD_RDY, 0xABCD, 0xEF, 0, DL_STATUS_OK, 0 };
+	tx_put(emu, &rdy);
+
+	dev->transport = &dl_transport_emu;
+	dev->priv = emu;
+	dev->release_number = EMU_RELEASE;
+
+	if (verbose)
+		printf("Emulated device, FW Ver: %d.%02d, %lux speed.\n", EMU_RELEASE >> 8, EMU_RELEASE & 0xFF, speed);
+
+	return dev;
+}
+
+const dl_transport_t dl_transport_emu = {
+	.name = "emu",
+	.description = "built-in device emulator, ARGS - speed-up factor",
+	.open = emu_open,
+	.close = emu_close,
+	.send_feature_report = emu_send_feature_report,
+	.get_feature_report = emu_get_feature_report,
+	.read_timeout = emu_read_timeout,
+	.error = emu_error,
+};
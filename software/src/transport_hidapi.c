@@ -0,0 +1,157 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defs.h"
+
+#include <hidapi.h>
+#include "transport.h"
+#include "usb_func.h"
+
+#if defined(__APPLE__) && HID_API_VERSION >= HID_API_MAKE_VERSION(0, 12, 0)
+#include <hidapi_darwin.h>
+#endif
+
+ // Fallback/example
+#ifndef HID_API_MAKE_VERSION
+#define HID_API_MAKE_VERSION(mj, mn, p) (((mj) << 24) | ((mn) << 8) | (p))
+#endif
+#ifndef HID_API_VERSION
+#define HID_API_VERSION HID_API_MAKE_VERSION(HID_API_VERSION_MAJOR, HID_API_VERSION_MINOR, HID_API_VERSION_PATCH)
+#endif
+
+/// @brief Enumerates DigiLivolo devices with hidapi and opens the first one found.
+/// @param args[in] device path to open instead, as printed by "digilivolo -v", NULL to find the device
+static dl_device_t* hidapi_open(const char* args, bool verbose)
+{
+	hid_device* handle = NULL;
+	struct hid_device_info* devices, * dl_dev;
+	unsigned short release_number = 0;
+
+#if defined(__APPLE__) && HID_API_VERSION >= HID_API_MAKE_VERSION(0, 12, 0)
+	// To work properly needs to be called before hid_open/hid_open_path after hid_init.
+	// Best/recommended option - call it right after hid_init.
+	hid_darwin_set_open_exclusive(0);
+#endif
+
+	if (args) {
+		handle = hid_open_path(args);
+		if (!handle) {
+			if (DL_PRINT_ERRORS(verbose))
+				printf("ERROR: unable to open %s\n", args);
+			return NULL;
+		}
+
+		struct hid_device_info* info = hid_get_device_info(handle);
+		release_number = info ? info->release_number : 0;
+	}
+	else {
+		devices = hid_enumerate(DIGILIVOLO_VID, DIGILIVOLO_PID);
+		dl_dev = find_digilivolo(devices);
+		if (!dl_dev) {
+			if (DL_PRINT_ERRORS(verbose))
+				printf("ERROR: unable to find device\n");
+			if (verbose) {
+				if (devices) {
+					printf("Devices with matching VID/PID (0x%04x:0x%04x), but wrong product or manufacturer string:\n", DIGILIVOLO_VID, DIGILIVOLO_PID);
+					print_devices(devices);
+				}
+				else {
+					hid_free_enumeration(devices);
+					devices = hid_enumerate(0, 0);
+					printf("All enumerated devices, but none of them match VID/PID (0x%04x:0x%04x):\n", DIGILIVOLO_VID, DIGILIVOLO_PID);
+					print_devices(devices);
+				}
+			}
+		}
+		else {
+			if (verbose) {
+				printf("Device found: ");
+				print_device(dl_dev);
+				printf("Opening device path: %s\n", dl_dev->path);
+			}
+			handle = hid_open_path(dl_dev->path);
+			release_number = dl_dev->release_number;
+		}
+
+		hid_free_enumeration(devices);
+	}
+
+	if (!handle)
+		return NULL;
+
+	// Set the hid_read() function to be non-blocking.
+	hid_set_nonblocking(handle, 1);
+
+	dl_device_t* dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		hid_close(handle);
+		return NULL;
+	}
+
+	dev->transport = &dl_transport_hidapi;
+	dev->priv = handle;
+	dev->release_number = release_number;
+	return dev;
+}
+
+static void hidapi_close(dl_device_t* dev)
+{
+	hid_close((hid_device*)dev->priv);
+	free(dev);
+}
+
+static int hidapi_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length)
+{
+	return hid_send_feature_report((hid_device*)dev->priv, data, length);
+}
+
+static int hidapi_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length)
+{
+	return hid_get_feature_report((hid_device*)dev->priv, data, length);
+}
+
+static int hidapi_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	return hid_read_timeout((hid_device*)dev->priv, data, length, milliseconds);
+}
+
+static const wchar_t* hidapi_error(dl_device_t* dev)
+{
+	const wchar_t* err = hid_error((hid_device*)dev->priv);
+
+	return err ? err : L"Success";
+}
+
+const dl_transport_t dl_transport_hidapi = {
+	.name = "hidapi",
+	.description = "USB device via hidapi, ARGS - device path",
+	.open = hidapi_open,
+	.close = hidapi_close,
+	.send_feature_report = hidapi_send_feature_report,
+	.get_feature_report = hidapi_get_feature_report,
+	.read_timeout = hidapi_read_timeout,
+	.error = hidapi_error,
+};
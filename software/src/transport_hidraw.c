@@ -0,0 +1,325 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Linux only: talks to the hidraw node directly. The device is found by VID/PID & strings
+ * in sysfs (no udev), feature reports are HIDIOCSFEATURE/HIDIOCGFEATURE ioctls straight from
+ * the caller buffer & input reports are waited for with epoll. */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/hidraw.h>
+
+#include "defs.h"
+#include "dl_time.h"
+#include "transport.h"
+
+#define HIDRAW_CLASS_DIR "/sys/class/hidraw"
+#define HIDRAW_BUS_USB 0x03
+
+typedef struct hidraw {
+	int fd;
+	int epoll_fd;
+	wchar_t error[128];
+} hidraw_t;
+
+/// @brief Reads the first line of a sysfs attribute, without the newline.
+/// @return true on success
+static bool read_attr(const char* dir, const char* name, char* buf, size_t len)
+{
+	char fname[PATH_MAX + 32];
+	FILE* f;
+	bool res;
+
+	snprintf(fname, sizeof(fname), "%s/%s", dir, name);
+	f = fopen(fname, "r");
+	if (!f)
+		return false;
+
+	res = (fgets(buf, (int)len, f) != NULL);
+	fclose(f);
+	if (res)
+		buf[strcspn(buf, "\n")] = '\0';
+
+	return res;
+}
+
+/// @brief Checks VID/PID of hidraw node from its HID device uevent.
+static bool id_matches(const char* node)
+{
+	char fname[PATH_MAX], line[256];
+	unsigned int bus, vid, pid;
+	bool res = false;
+	FILE* f;
+
+	snprintf(fname, sizeof(fname), HIDRAW_CLASS_DIR "/%s/device/uevent", node);
+	f = fopen(fname, "r");
+	if (!f)
+		return false;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vid, &pid) == 3) {
+			res = (bus == HIDRAW_BUS_USB && vid == DIGILIVOLO_VID && pid == DIGILIVOLO_PID);
+			break;
+		}
+	}
+
+	fclose(f);
+	return res;
+}
+
+/// @brief Finds USB device directory (one with idVendor) of hidraw node in sysfs.
+/// @param node[in] hidraw node name, i.e. "hidraw3"
+/// @param dir[out] buffer for the directory path
+/// @return false for virtual (uhid) devices which aren't on USB
+static bool usb_dir(const char* node, char* dir)
+{
+	char fname[PATH_MAX], attr[16];
+
+	snprintf(fname, sizeof(fname), HIDRAW_CLASS_DIR "/%s/device", node);
+	if (!realpath(fname, dir))
+		return false;
+
+	// HID device sits under USB interface, which sits under USB device
+	for (char* slash; (slash = strrchr(dir, '/')) != NULL && slash != dir; ) {
+		*slash = '\0';
+		if (read_attr(dir, "idVendor", attr, sizeof(attr)))
+			return true;
+	}
+
+	return false;
+}
+
+/// @brief Reads USB release number (bcdDevice) & checks manufacturer & product strings.
+/// @param node[in] hidraw node name
+/// @param release_number[out] USB release number, 0 if unknown
+/// @return true if strings match DigiLivolo
+static bool usb_info(const char* node, unsigned short* release_number, bool verbose)
+{
+	char dir[PATH_MAX], manufacturer[128] = "", product[128] = "", attr[16], expected[128];
+	bool res;
+
+	*release_number = 0;
+	if (!usb_dir(node, dir))
+		return false;
+
+	read_attr(dir, "manufacturer", manufacturer, sizeof(manufacturer));
+	read_attr(dir, "product", product, sizeof(product));
+	if (read_attr(dir, "bcdDevice", attr, sizeof(attr)))
+		*release_number = (unsigned short)strtoul(attr, NULL, 16);
+
+	snprintf(expected, sizeof(expected), "%ls", DIGILIVOLO_MANUFACTURER_STRING);
+	res = (strcmp(manufacturer, expected) == 0);
+	snprintf(expected, sizeof(expected), "%ls", DIGILIVOLO_PRODUCT_STRING);
+	res = res && (strcmp(product, expected) == 0);
+
+	if (verbose)
+		printf("/dev/%s: %s %s, release %hx%s\n", node, manufacturer, product, *release_number, res ? "" : ", wrong strings");
+
+	return res;
+}
+
+/// @brief Finds first DigiLivolo hidraw node.
+/// @param path[out] buffer for "/dev/hidrawN"
+/// @return true if found
+static bool find_node(char* path, size_t len, unsigned short* release_number, bool verbose)
+{
+	DIR* dir = opendir(HIDRAW_CLASS_DIR);
+	struct dirent* ent;
+	bool found = false;
+
+	if (!dir) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: unable to list " HIDRAW_CLASS_DIR ": %s\n", strerror(errno));
+		return false;
+	}
+
+	while (!found && (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.' || !id_matches(ent->d_name))
+			continue;
+
+		if (usb_info(ent->d_name, release_number, verbose)) {
+			snprintf(path, len, "/dev/%s", ent->d_name);
+			found = true;
+		}
+	}
+
+	closedir(dir);
+	return found;
+}
+
+static void set_error(hidraw_t* hr, const char* op)
+{
+	swprintf(hr->error, sizeof(hr->error) / sizeof(hr->error[0]), L"%s: %s", op, strerror(errno));
+}
+
+/// @brief Opens DigiLivolo hidraw node & sets up epoll for its input reports.
+/// @param args[in] hidraw node path, NULL to find the device
+static dl_device_t* hidraw_open(const char* args, bool verbose)
+{
+	char path[PATH_MAX];
+	unsigned short release_number = 0;
+
+	if (args) {
+		const char* node = strrchr(args, '/');
+		snprintf(path, sizeof(path), "%s", args);
+		// Release number is only known for the USB devices
+		usb_info(node ? node + 1 : args, &release_number, verbose);
+	}
+	else if (!find_node(path, sizeof(path), &release_number, verbose)) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: unable to find device\n");
+		return NULL;
+	}
+
+	if (verbose)
+		printf("Opening device path: %s\n", path);
+
+	dl_device_t* dev = calloc(1, sizeof(*dev));
+	hidraw_t* hr = calloc(1, sizeof(*hr));
+	if (!dev || !hr) {
+		free(dev);
+		free(hr);
+		return NULL;
+	}
+
+	hr->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (hr->fd < 0) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: unable to open %s: %s\n", path, strerror(errno));
+		free(dev);
+		free(hr);
+		return NULL;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN };
+	hr->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (hr->epoll_fd < 0 || epoll_ctl(hr->epoll_fd, EPOLL_CTL_ADD, hr->fd, &ev) < 0) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: epoll setup failed: %s\n", strerror(errno));
+		if (hr->epoll_fd >= 0)
+			close(hr->epoll_fd);
+		close(hr->fd);
+		free(dev);
+		free(hr);
+		return NULL;
+	}
+
+	wcscpy(hr->error, L"Success");
+	dev->transport = &dl_transport_hidraw;
+	dev->priv = hr;
+	dev->release_number = release_number;
+	return dev;
+}
+
+static void hidraw_close(dl_device_t* dev)
+{
+	hidraw_t* hr = dev->priv;
+
+	close(hr->epoll_fd);
+	close(hr->fd);
+	free(hr);
+	free(dev);
+}
+
+static int hidraw_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length)
+{
+	hidraw_t* hr = dev->priv;
+	int res = ioctl(hr->fd, HIDIOCSFEATURE(length), data);
+
+	if (res < 0)
+		set_error(hr, "HIDIOCSFEATURE");
+	return res;
+}
+
+static int hidraw_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length)
+{
+	hidraw_t* hr = dev->priv;
+	int res = ioctl(hr->fd, HIDIOCGFEATURE(length), data);
+
+	if (res < 0)
+		set_error(hr, "HIDIOCGFEATURE");
+	return res;
+}
+
+static int hidraw_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	hidraw_t* hr = dev->priv;
+	uint64_t deadline = dl_time_us() + (uint64_t)milliseconds * 1000;
+	struct epoll_event ev;
+
+	for (;;) {
+		ssize_t res = read(hr->fd, data, length);
+		if (res >= 0)
+			return (int)res;
+		if (errno != EAGAIN && errno != EINTR) {
+			set_error(hr, "read");
+			return -1;
+		}
+		if (milliseconds == 0)
+			return 0;
+
+		// Report arrival wakes epoll, EINTR & spurious wakeups retry the read with the time left
+		int timeout = -1;
+		if (milliseconds > 0) {
+			uint64_t now = dl_time_us();
+			timeout = (now < deadline) ? (int)((deadline - now + 999) / 1000) : 0;
+		}
+		int n = epoll_wait(hr->epoll_fd, &ev, 1, timeout);
+		if (n == 0)
+			return 0;
+		if (n < 0 && errno != EINTR) {
+			set_error(hr, "epoll_wait");
+			return -1;
+		}
+	}
+}
+
+static int hidraw_poll_fd(dl_device_t* dev)
+{
+	return ((hidraw_t*)dev->priv)->fd;
+}
+
+static const wchar_t* hidraw_error(dl_device_t* dev)
+{
+	return ((hidraw_t*)dev->priv)->error;
+}
+
+const dl_transport_t dl_transport_hidraw = {
+	.name = "hidraw",
+	.description = "Linux hidraw node directly, ARGS - device path",
+	.open = hidraw_open,
+	.close = hidraw_close,
+	.send_feature_report = hidraw_send_feature_report,
+	.get_feature_report = hidraw_get_feature_report,
+	.read_timeout = hidraw_read_timeout,
+	.poll_fd = hidraw_poll_fd,
+	.error = hidraw_error,
+};
@@ -0,0 +1,440 @@
+/* Part of the DigiLivolo control software.
+ * https://github.com/N-Storm/DigiLivolo/
+ * Copyright (c) 2024,2025 GitHub user N-Storm.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Native libusb transport with asynchronous control transfers. Command reports (REPORT_ID &
+ * REPORT_ID_MULTI) are submitted with libusb_submit_transfer() and return at once, up to
+ * LIBUSB_INFLIGHT of them in flight, so host USB stack latency overlaps with the device
+ * processing the previous ones. That's done for the firmware with the status report only, as
+ * the host keeps its queue from overflowing & late reported stall is rare. Other reports wait
+ * for their own transfer, which completes after the ones submitted before it, as control
+ * transfers are done in order. Interrupt IN transfer is kept submitted all the time & its
+ * reports are queued until read. All devices share one libusb context, so completions of
+ * several dongles are collected by the same event loop. */
+
+#include <stdio.h>
+#include <wchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libusb.h>
+
+#include "defs.h"
+#include "dl_time.h"
+#include "transport.h"
+
+// Command reports in flight at once
+#define LIBUSB_INFLIGHT 4
+// Largest report, REPORT_ID_MULTI & REPORT_ID_DATA
+#define LIBUSB_REPORT_MAX 64
+#define LIBUSB_CTRL_TIMEOUT_MS 1000
+#define LIBUSB_INTERFACE 0
+// V-USB interrupt IN endpoint 1
+#define LIBUSB_INTR_EP 0x81
+// Input reports kept until read, as DLUSB_TX_QUEUE_SIZE in the firmware
+#define LIBUSB_INPUT_QUEUE 8
+
+// HID class requests & report type
+#define HID_GET_REPORT 0x01
+#define HID_SET_REPORT 0x09
+#define HID_REPORT_FEATURE 0x03
+
+typedef struct usb_dev usb_dev_t;
+
+typedef struct usb_xfer {
+	struct libusb_transfer* transfer;
+	usb_dev_t* owner;
+	bool busy;
+	bool pipelined; // Nobody waits for it, errors are reported on the next send
+	int done; // libusb_handle_events_timeout_completed() flag
+	unsigned char buf[LIBUSB_CONTROL_SETUP_SIZE + LIBUSB_REPORT_MAX];
+} usb_xfer_t;
+
+struct usb_dev {
+	libusb_device_handle* handle;
+	usb_xfer_t xfers[LIBUSB_INFLIGHT];
+	struct libusb_transfer* intr;
+	bool intr_active;
+	unsigned char intr_buf[sizeof(dlusb_packet_t)];
+	unsigned char input[LIBUSB_INPUT_QUEUE][sizeof(dlusb_packet_t)];
+	uint8_t input_len[LIBUSB_INPUT_QUEUE];
+	uint8_t input_head, input_tail; // Free running
+	bool pipeline; // Command reports are pipelined
+	bool failed; // Pipelined transfer failed
+	const wchar_t* error;
+};
+
+// Shared by all open devices
+static libusb_context* ctx = NULL;
+static int ctx_users = 0;
+
+static bool ctx_get(bool verbose)
+{
+	if (ctx_users == 0 && libusb_init(&ctx) != 0) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: libusb_init() failed\n");
+		return false;
+	}
+
+	ctx_users++;
+	return true;
+}
+
+static void ctx_put(void)
+{
+	if (--ctx_users == 0) {
+		libusb_exit(ctx);
+		ctx = NULL;
+	}
+}
+
+/// @brief Handles pending libusb events, waiting up to milliseconds for them.
+/// @param done[in] completion flag to return early on, NULL if none
+static void handle_events(int* done, int milliseconds)
+{
+	struct timeval tv = { milliseconds / 1000, (milliseconds % 1000) * 1000 };
+
+	libusb_handle_events_timeout_completed(ctx, &tv, done);
+}
+
+static void LIBUSB_CALL ctrl_cb(struct libusb_transfer* transfer)
+{
+	usb_xfer_t* x = transfer->user_data;
+
+	if (x->pipelined) {
+		if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+			x->owner->failed = true;
+			x->owner->error = (transfer->status == LIBUSB_TRANSFER_STALL) ? L"Command report stalled" : L"Command report failed";
+		}
+		x->busy = false;
+	}
+	x->done = 1;
+}
+
+static void LIBUSB_CALL intr_cb(struct libusb_transfer* transfer)
+{
+	usb_dev_t* ud = transfer->user_data;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length > 0 && \
+		(uint8_t)(ud->input_head - ud->input_tail) < LIBUSB_INPUT_QUEUE) {
+		uint8_t slot = ud->input_head++ % LIBUSB_INPUT_QUEUE;
+		memcpy(ud->input[slot], transfer->buffer, (size_t)transfer->actual_length);
+		ud->input_len[slot] = (uint8_t)transfer->actual_length;
+	}
+
+	// Keep it submitted until the device is closed or gone
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED || transfer->status == LIBUSB_TRANSFER_NO_DEVICE || \
+		libusb_submit_transfer(transfer) != 0)
+		ud->intr_active = false;
+}
+
+/// @brief Takes free transfer, waiting for a pipelined one to complete if all are in flight.
+static usb_xfer_t* xfer_get(usb_dev_t* ud)
+{
+	for (;;) {
+		for (size_t i = 0; i < LIBUSB_INFLIGHT; i++) {
+			if (!ud->xfers[i].busy)
+				return &ud->xfers[i];
+		}
+		handle_events(NULL, LIBUSB_CTRL_TIMEOUT_MS);
+	}
+}
+
+/// @brief Submits HID class control transfer for the feature report.
+/// @param data[in] report with report ID in the first byte, copied for SET_REPORT
+/// @return submitted transfer or NULL on error
+static usb_xfer_t* submit(usb_dev_t* ud, uint8_t request, const unsigned char* data, size_t length, bool pipelined)
+{
+	if (length > LIBUSB_REPORT_MAX) {
+		ud->error = L"Report too long";
+		return NULL;
+	}
+
+	usb_xfer_t* x = xfer_get(ud);
+	uint8_t dir = (request == HID_SET_REPORT) ? LIBUSB_ENDPOINT_OUT : LIBUSB_ENDPOINT_IN;
+
+	libusb_fill_control_setup(x->buf, dir | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, request, \
+		(HID_REPORT_FEATURE << 8) | data[0], LIBUSB_INTERFACE, (uint16_t)length);
+	if (request == HID_SET_REPORT)
+		memcpy(x->buf + LIBUSB_CONTROL_SETUP_SIZE, data, length);
+	libusb_fill_control_transfer(x->transfer, ud->handle, x->buf, ctrl_cb, x, LIBUSB_CTRL_TIMEOUT_MS);
+
+	x->pipelined = pipelined;
+	x->done = 0;
+	x->busy = true;
+	if (libusb_submit_transfer(x->transfer) != 0) {
+		x->busy = false;
+		ud->error = L"Unable to submit transfer";
+		return NULL;
+	}
+
+	return x;
+}
+
+/// @brief Waits for the transfer somebody waits for & frees it.
+/// @return bytes transferred or -1 on error
+static int wait(usb_dev_t* ud, usb_xfer_t* x)
+{
+	while (!x->done)
+		handle_events(&x->done, LIBUSB_CTRL_TIMEOUT_MS);
+
+	x->busy = false;
+	if (x->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		ud->error = (x->transfer->status == LIBUSB_TRANSFER_STALL) ? L"Report stalled" : L"Transfer failed";
+		return -1;
+	}
+
+	return x->transfer->actual_length;
+}
+
+/// @brief Reads string descriptor & compares it to the expected one.
+static bool string_matches(libusb_device_handle* handle, uint8_t index, const wchar_t* expected)
+{
+	unsigned char str[128];
+	char exp[128];
+
+	if (index == 0 || libusb_get_string_descriptor_ascii(handle, index, str, sizeof(str)) < 0)
+		return false;
+
+	snprintf(exp, sizeof(exp), "%ls", expected);
+	return strcmp((const char*)str, exp) == 0;
+}
+
+/// @brief Finds & opens DigiLivolo device.
+/// @param args[in] "BUS:ADDRESS" of the device to open, NULL for the first one found
+/// @param release_number[out] USB bcdDevice
+static libusb_device_handle* find_device(const char* args, unsigned short* release_number, bool verbose)
+{
+	libusb_device** list;
+	libusb_device_handle* handle = NULL;
+	unsigned int bus = 0, address = 0;
+	ssize_t count;
+
+	if (args && sscanf(args, "%u:%u", &bus, &address) != 2) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: libusb transport argument should be BUS:ADDRESS\n");
+		return NULL;
+	}
+
+	count = libusb_get_device_list(ctx, &list);
+	if (count < 0)
+		return NULL;
+
+	for (ssize_t i = 0; i < count && !handle; i++) {
+		struct libusb_device_descriptor desc;
+
+		if (libusb_get_device_descriptor(list[i], &desc) != 0 || \
+			desc.idVendor != DIGILIVOLO_VID || desc.idProduct != DIGILIVOLO_PID)
+			continue;
+		if (args && (libusb_get_bus_number(list[i]) != bus || libusb_get_device_address(list[i]) != address))
+			continue;
+		if (libusb_open(list[i], &handle) != 0) {
+			if (verbose)
+				printf("Unable to open USB device %u:%u\n", libusb_get_bus_number(list[i]), libusb_get_device_address(list[i]));
+			continue;
+		}
+
+		if (!string_matches(handle, desc.iManufacturer, DIGILIVOLO_MANUFACTURER_STRING) || \
+			!string_matches(handle, desc.iProduct, DIGILIVOLO_PRODUCT_STRING)) {
+			libusb_close(handle);
+			handle = NULL;
+			continue;
+		}
+
+		*release_number = desc.bcdDevice;
+		if (verbose)
+			printf("Device found on USB %u:%u, FW Ver: %d.%02d\n", libusb_get_bus_number(list[i]), libusb_get_device_address(list[i]), \
+				desc.bcdDevice >> 8, desc.bcdDevice & 0xFF);
+	}
+
+	libusb_free_device_list(list, 1);
+	return handle;
+}
+
+static void usb_free(usb_dev_t* ud)
+{
+	for (size_t i = 0; i < LIBUSB_INFLIGHT; i++)
+		libusb_free_transfer(ud->xfers[i].transfer);
+	libusb_free_transfer(ud->intr);
+	free(ud);
+}
+
+static void lusb_close(dl_device_t* dev)
+{
+	usb_dev_t* ud = dev->priv;
+
+	// Let pipelined commands reach the device, then stop the interrupt transfer
+	for (size_t i = 0; i < LIBUSB_INFLIGHT; i++) {
+		while (ud->xfers[i].busy)
+			handle_events(&ud->xfers[i].done, LIBUSB_CTRL_TIMEOUT_MS);
+	}
+	if (ud->intr_active) {
+		libusb_cancel_transfer(ud->intr);
+		while (ud->intr_active)
+			handle_events(NULL, LIBUSB_CTRL_TIMEOUT_MS);
+	}
+
+	libusb_release_interface(ud->handle, LIBUSB_INTERFACE);
+	libusb_close(ud->handle);
+	usb_free(ud);
+	free(dev);
+	ctx_put();
+}
+
+static dl_device_t* lusb_open(const char* args, bool verbose)
+{
+	unsigned short release_number = 0;
+
+	if (!ctx_get(verbose))
+		return NULL;
+
+	dl_device_t* dev = calloc(1, sizeof(*dev));
+	usb_dev_t* ud = calloc(1, sizeof(*ud));
+	if (!dev || !ud)
+		goto fail;
+
+	for (size_t i = 0; i < LIBUSB_INFLIGHT; i++) {
+		ud->xfers[i].owner = ud;
+		if (!(ud->xfers[i].transfer = libusb_alloc_transfer(0)))
+			goto fail;
+	}
+	if (!(ud->intr = libusb_alloc_transfer(0)))
+		goto fail;
+
+	ud->handle = find_device(args, &release_number, verbose);
+	if (!ud->handle) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: unable to find device\n");
+		goto fail;
+	}
+
+	// usbhid driver has to let go of the interface for the class requests to pass
+	libusb_set_auto_detach_kernel_driver(ud->handle, 1);
+	if (libusb_claim_interface(ud->handle, LIBUSB_INTERFACE) != 0) {
+		if (DL_PRINT_ERRORS(verbose))
+			printf("ERROR: unable to claim device interface\n");
+		libusb_close(ud->handle);
+		goto fail;
+	}
+
+	libusb_fill_interrupt_transfer(ud->intr, ud->handle, LIBUSB_INTR_EP, ud->intr_buf, sizeof(ud->intr_buf), intr_cb, ud, 0);
+	ud->intr_active = (libusb_submit_transfer(ud->intr) == 0);
+
+	ud->pipeline = (release_number >= DL_FW_VERSION_STATUS);
+	ud->error = L"Success";
+	dev->transport = &dl_transport_libusb;
+	dev->priv = ud;
+	dev->release_number = release_number;
+	return dev;
+
+fail:
+	if (ud)
+		usb_free(ud);
+	free(dev);
+	ctx_put();
+	return NULL;
+}
+
+static int lusb_send_feature_report(dl_device_t* dev, const unsigned char* data, size_t length)
+{
+	usb_dev_t* ud = dev->priv;
+	bool pipelined = ud->pipeline && (data[0] == REPORT_ID || data[0] == REPORT_ID_MULTI);
+
+	// Lost pipelined command is reported once, like a stall of this one
+	if (ud->failed) {
+		ud->failed = false;
+		return -1;
+	}
+
+	usb_xfer_t* x = submit(ud, HID_SET_REPORT, data, length, pipelined);
+	if (!x)
+		return -1;
+	if (pipelined) {
+		// Give the completions a chance, without blocking
+		handle_events(NULL, 0);
+		return (int)length;
+	}
+
+	int res = wait(ud, x);
+	return (res < 0) ? -1 : (int)length;
+}
+
+static int lusb_get_feature_report(dl_device_t* dev, unsigned char* data, size_t length)
+{
+	usb_dev_t* ud = dev->priv;
+	usb_xfer_t* x = submit(ud, HID_GET_REPORT, data, length, false);
+	int res;
+
+	if (!x)
+		return -1;
+
+	res = wait(ud, x);
+	if (res > 0)
+		memcpy(data, x->buf + LIBUSB_CONTROL_SETUP_SIZE, (size_t)res);
+	return res;
+}
+
+static int lusb_read_timeout(dl_device_t* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	usb_dev_t* ud = dev->priv;
+	uint64_t deadline = dl_time_us() + (uint64_t)(milliseconds > 0 ? milliseconds : 0) * 1000;
+
+	// Control transfer completions wake the event loop too, so it's run until the deadline
+	while (ud->input_head == ud->input_tail) {
+		uint64_t now = dl_time_us();
+		int timeout = LIBUSB_CTRL_TIMEOUT_MS; // Negative timeout waits forever, in rounds
+
+		if (!ud->intr_active) {
+			ud->error = L"Interrupt transfer stopped";
+			return -1;
+		}
+		if (milliseconds > 0 && now >= deadline)
+			return 0;
+		// Zero timeout only handles the events already pending
+		if (milliseconds >= 0)
+			timeout = (now < deadline) ? (int)((deadline - now + 999) / 1000) : 0;
+
+		handle_events(NULL, timeout);
+		if (milliseconds == 0 && ud->input_head == ud->input_tail)
+			return 0;
+	}
+
+	uint8_t slot = ud->input_tail++ % LIBUSB_INPUT_QUEUE;
+	size_t size = (length < ud->input_len[slot]) ? length : ud->input_len[slot];
+	memcpy(data, ud->input[slot], size);
+	return (int)size;
+}
+
+static const wchar_t* lusb_error(dl_device_t* dev)
+{
+	return ((usb_dev_t*)dev->priv)->error;
+}
+
+const dl_transport_t dl_transport_libusb = {
+	.name = "libusb",
+	.description = "USB device via libusb with pipelined control transfers, ARGS - BUS:ADDRESS",
+	.open = lusb_open,
+	.close = lusb_close,
+	.send_feature_report = lusb_send_feature_report,
+	.get_feature_report = lusb_get_feature_report,
+	.read_timeout = lusb_read_timeout,
+	.error = lusb_error,
+};
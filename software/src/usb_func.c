@@ -26,18 +26,12 @@
 #include <stdint.h>
 
 #include "defs.h"
+#include "dl_time.h"
 
 #include <hidapi.h>
+#include "transport.h"
 #include "usb_func.h"
 
- // Fallback/example
-#ifndef HID_API_MAKE_VERSION
-#define HID_API_MAKE_VERSION(mj, mn, p) (((mj) << 24) | ((mn) << 8) | (p))
-#endif
-#ifndef HID_API_VERSION
-#define HID_API_VERSION HID_API_MAKE_VERSION(HID_API_VERSION_MAJOR, HID_API_VERSION_MINOR, HID_API_VERSION_PATCH)
-#endif
-
 const char* hid_bus_name(hid_bus_type bus_type) {
 	static const char* const HidBusTypeName[] = {
 		"Unknown",
@@ -90,10 +84,25 @@ struct hid_device_info* find_digilivolo(struct hid_device_info* cur_dev) {
 	return NULL;
 }
 
-error_t dlusb_send(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, hid_device* handle) {
+uint8_t dlusb_next_seq(void) {
+	static uint8_t seq = 0;
+
+	/* Start from a time based value, so ACKs left in the device queue by a
+	 * previous run are unlikely to match our first commands. */
+	if (seq == 0)
+		seq = (uint8_t)(dl_time_us() >> 10);
+
+	// 0 means untagged command, skip it
+	if (++seq == 0)
+		seq = 1;
+
+	return seq;
+}
+
+error_t dlusb_send(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t repeats, uint8_t seq, dl_device_t* handle) {
 	int res;
 	// Buffer to constuct packet. HID Report descriptor configured to work with 8 bytes.
-	// But the actual packet struct a bit smaller, so we "fit" it inside buffer.
+	// Firmware older than DL_FW_VERSION_REPEATS ignores the last byte (repeats).
 	unsigned char buf[8] = { 0 };
 	dlusb_packet_t* packet = (dlusb_packet_t*)buf;
 
@@ -101,13 +110,172 @@ error_t dlusb_send(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, hid_dev
 	packet->cmd_id = use_old_alg ? CMD_SWITCH_OLD : CMD_SWITCH;
 	packet->remote_id = remote_id;
 	packet->btn_id = btn_id;
+	packet->seq = seq;
+	packet->status = (handle->caps.intr ? DL_FLAG_INTR : 0) | (handle->caps.times_on ? DL_FLAG_TIMES : 0);
+	packet->repeats = repeats;
 
 	/// Send a Feature Report to the device
-	res = hid_send_feature_report(handle, buf, sizeof(buf));
+	res = dl_send_feature_report(handle, buf, sizeof(buf));
+	return res;
+}
+
+bool dlusb_has_multi(const dl_device_t* handle) {
+	return handle->caps.multi;
+}
+
+error_t dlusb_send_multi(const dl_tuple_t* tuples, uint8_t count, uint8_t repeats, uint8_t seq, dl_device_t* handle) {
+	dlusb_multi_packet_t packet;
+
+	if (count == 0 || count > DL_MULTI_MAX)
+		return -1;
+
+	// Report size is fixed by the descriptor, unused tuples are sent zeroed
+	memset(&packet, 0, sizeof(packet));
+	packet.report_id = REPORT_ID_MULTI;
+	packet.cmd_id = CMD_SWITCH_MULTI;
+	packet.seq = seq;
+	packet.status = handle->caps.intr ? DL_FLAG_INTR : 0;
+	packet.count = count;
+	packet.repeats = repeats;
+	memcpy(packet.tuples, tuples, count * sizeof(dl_tuple_t));
+
+	return dl_send_feature_report(handle, (unsigned char*)&packet, sizeof(packet));
+}
+
+bool dlusb_has_repeats(const dl_device_t* handle) {
+	return handle->caps.repeats;
+}
+
+bool dlusb_has_status(const dl_device_t* handle) {
+	return handle->caps.status;
+}
+
+error_t dlusb_get_status(dlusb_status_packet_t* status, dl_device_t* handle) {
+	unsigned char buf[sizeof(dlusb_status_packet_t)] = { REPORT_ID_STATUS };
+	int res;
+
+	res = dl_get_feature_report(handle, buf, sizeof(buf));
+	if (res < 0)
+		return res;
+	else if (res < (int)sizeof(buf) || buf[1] != CMD_STATUS)
+		return -1;
+
+	memcpy(status, buf, sizeof(*status));
+	return res;
+}
+
+bool dlusb_has_stats(const dl_device_t* handle) {
+	return handle->caps.stats;
+}
+
+error_t dlusb_get_stats(dlusb_stats_packet_t* stats, dl_device_t* handle) {
+	unsigned char buf[sizeof(dlusb_stats_packet_t)] = { REPORT_ID_STATS };
+	int res;
+
+	res = dl_get_feature_report(handle, buf, sizeof(buf));
+	if (res < 0)
+		return res;
+	else if (res < (int)sizeof(buf) || buf[1] != CMD_STATS)
+		return -1;
+
+	memcpy(stats, buf, sizeof(*stats));
 	return res;
 }
 
-error_t dlusb_read(dlusb_packet_t* packet, hid_device* handle) {
+bool dlusb_has_times(const dl_device_t* handle) {
+	return handle->caps.times;
+}
+
+bool dlusb_request_times(dl_device_t* handle, bool enable) {
+	handle->caps.times_on = enable && handle->caps.times;
+	return handle->caps.times_on == enable;
+}
+
+bool dlusb_times_requested(const dl_device_t* handle) {
+	return handle->caps.times_on;
+}
+
+error_t dlusb_wait_times(dlusb_times_packet_t* times, uint8_t seq, dl_device_t* handle, bool verbose) {
+	dlusb_packet_t packet;
+
+	if (dlusb_wait_reply(&packet, seq, handle, DLUSB_TIMES_TIMEOUT_MS, verbose) != DLUSB_OK)
+		return DLUSB_ERR_TIMEOUT;
+	else if (packet.cmd_id != CMD_TIMES)
+		return DLUSB_ERR_REPLY;
+
+	memcpy(times, &packet, sizeof(*times));
+	return DLUSB_OK;
+}
+
+bool dlusb_has_scenes(const dl_device_t* handle) {
+	return handle->caps.scenes;
+}
+
+error_t dlusb_send_scene(uint8_t scene_id, uint8_t seq, dl_device_t* handle) {
+	unsigned char buf[8] = { 0 };
+	dlusb_packet_t* packet = (dlusb_packet_t*)buf;
+
+	packet->report_id = REPORT_ID;
+	packet->cmd_id = CMD_SCENE;
+	packet->btn_id = scene_id;
+	packet->seq = seq;
+	packet->status = handle->caps.intr ? DL_FLAG_INTR : 0;
+
+	return dl_send_feature_report(handle, buf, sizeof(buf));
+}
+
+error_t dlusb_send_data(uint8_t cmd_id, uint16_t offset, const uint8_t* data, uint8_t seq, dl_device_t* handle) {
+	dlusb_data_packet_t packet;
+
+	packet.report_id = REPORT_ID_DATA;
+	packet.cmd_id = cmd_id;
+	packet.seq = seq;
+	packet.status = handle->caps.intr ? DL_FLAG_INTR : 0;
+	packet.offset = offset;
+	memcpy(packet.data, data, DL_DATA_SIZE);
+
+	return dl_send_feature_report(handle, (unsigned char*)&packet, sizeof(packet));
+}
+
+bool dlusb_has_timing(const dl_device_t* handle) {
+	return handle->caps.timing;
+}
+
+error_t dlusb_get_timing(dl_timing_t* timing, dl_device_t* handle) {
+	dlusb_data_packet_t packet = { REPORT_ID_DATA };
+	int res;
+
+	res = dl_get_feature_report(handle, (unsigned char*)&packet, sizeof(packet));
+	if (res < 0)
+		return res;
+	else if (res < (int)sizeof(packet) || packet.cmd_id != CMD_TIMING)
+		return -1;
+
+	memcpy(timing, packet.data, sizeof(*timing));
+	return res;
+}
+
+error_t dlusb_set_timing(const dl_timing_t* timing, dl_device_t* handle, bool verbose) {
+	uint8_t data[DL_DATA_SIZE] = { 0 };
+	uint8_t seq = dlusb_next_seq();
+	dlusb_packet_t packet;
+
+	memcpy(data, timing, sizeof(*timing));
+	if (dlusb_send_data(CMD_TIMING_WRITE, 0, data, seq, handle) < 0)
+		return DLUSB_ERR_SEND;
+
+	if (dlusb_wait_reply(&packet, seq, handle, DLUSB_ACK_TIMEOUT_MS, verbose) != DLUSB_OK)
+		return DLUSB_ERR_TIMEOUT;
+
+	if (packet.status != DL_STATUS_OK)
+		return DLUSB_ERR_STATUS;
+	else if (packet.cmd_id != CMD_TIMING_WRITE)
+		return DLUSB_ERR_REPLY;
+
+	return DLUSB_OK;
+}
+
+error_t dlusb_read(dlusb_packet_t* packet, dl_device_t* handle) {
 	int res;
 
 	// Buffer for incoming packet
@@ -116,7 +284,7 @@ error_t dlusb_read(dlusb_packet_t* packet, hid_device* handle) {
 	// Read a Feature Report from the device
 	// ((dlusb_packet_t*)buf)->report_id = REPORT_ID;
 	buf[0] = REPORT_ID;
-	res = hid_get_feature_report(handle, buf, sizeof(buf));
+	res = dl_get_feature_report(handle, buf, sizeof(buf));
 
 	// Copy packet data to output pointer if request was successful
 	if (res >= 0)
@@ -124,3 +292,217 @@ error_t dlusb_read(dlusb_packet_t* packet, hid_device* handle) {
 
 	return res;
 }
+
+/// @brief Sets the firmware capabilities of the device from its release number.
+static void set_caps(dl_device_t* handle) {
+	unsigned short release_number = handle->release_number;
+	dl_caps_t* caps = &handle->caps;
+
+	caps->intr = (release_number >= DL_FW_VERSION_INTR);
+	caps->multi = (release_number >= DL_FW_VERSION_MULTI);
+	caps->status = (release_number >= DL_FW_VERSION_STATUS);
+	caps->scenes = (release_number >= DL_FW_VERSION_SCENE);
+	caps->timing = (release_number >= DL_FW_VERSION_TIMING);
+	caps->repeats = (release_number >= DL_FW_VERSION_REPEATS);
+	caps->stats = (release_number >= DL_FW_VERSION_STATS);
+	caps->times = (release_number >= DL_FW_VERSION_TIMES);
+	caps->times_on = false;
+}
+
+dl_device_t* dlusb_open(const char* transport, bool verbose) {
+	dl_device_t* handle = dl_transport_open(transport, verbose);
+
+	if (!handle)
+		return NULL;
+
+	set_caps(handle);
+	if (verbose && handle->caps.intr)
+		printf("Using interrupt IN reports for device replies.\n");
+
+	/* Firmware which doesn't echo seq numbers has to be drained from stale reports
+	 * (RDY packet, ACKs left from previous runs), as ACKs are matched by content.
+	 * Newer firmware replies are matched by seq & stale ones just skipped. */
+	if (handle->release_number < DL_FW_VERSION_SEQ)
+		dlusb_drain(handle, verbose);
+
+	return handle;
+}
+
+void dlusb_drain(dl_device_t* handle, bool verbose) {
+	dlusb_packet_t packet;
+	int res = 1;
+
+	while (res) {
+		res = dlusb_read(&packet, handle);
+		if (res < 0) {
+			if (DL_PRINT_ERRORS(verbose))
+				printf("WARN: (%d) Unable to get a feature report: %ls\n", res, dl_error(handle));
+		}
+		else if (res > 0 && verbose) {
+#ifdef DEBUG
+			// Print out the returned buffer.
+			printf("Read Feature Report from DigiLivolo: ");
+			for (uint32_t i = 0; i < res; i++)
+				printf("%02x ", *(((uint8_t*)&packet) + i));
+			printf("\n");
+#endif // DEBUG
+		}
+	}
+}
+
+error_t dlusb_wait_packet(dlusb_packet_t* packet, dl_device_t* handle, uint32_t timeout_ms) {
+	uint64_t deadline = dl_time_us() + timeout_ms * 1000ULL;
+	uint32_t step = DLUSB_ACK_POLL_MIN_MS;
+	int res;
+
+	if (handle->caps.intr) {
+		unsigned char buf[8] = { 0 };
+
+		/* Block until device pushes a report, no polling needed. Zero length reports, which device
+		 * sends for its clock tracking, are passed through by some backends & read past. */
+		do {
+			uint64_t now = dl_time_us();
+			uint32_t left = (now < deadline) ? (uint32_t)((deadline - now + 999) / 1000) : 0;
+			res = dl_read_timeout(handle, buf, sizeof(buf), (int)left);
+		} while (res == 0 && dl_time_us() < deadline);
+		if (res > 0) {
+			memcpy(packet, buf, sizeof(*packet));
+			return res;
+		}
+		else if (res == 0)
+			return DLUSB_ERR_TIMEOUT;
+
+		/* Read error, interrupt reports might not work with this backend. Fall back
+		 * to the feature reports, next commands will be sent without DL_FLAG_INTR. */
+		if (DL_PRINT_ERRORS(handle->verbose))
+			printf("WARN: (%d) Unable to read an input report: %ls\n", res, dl_error(handle));
+		handle->caps.intr = false;
+	}
+
+	for (;;) {
+		res = dlusb_read(packet, handle);
+		if (res > 0)
+			break;
+
+		/* Empty reply (or -1 from some hidapi backends) means device has nothing
+		 * to report yet, i.e. it's still transmitting. */
+		uint64_t now = dl_time_us();
+		if (now >= deadline)
+			return DLUSB_ERR_TIMEOUT;
+
+		// Don't sleep past the deadline
+		if (now + step * 1000ULL > deadline)
+			step = (uint32_t)((deadline - now + 999) / 1000);
+		dl_sleep_ms(step);
+
+		// Exponential backoff, capped to keep ACK detection delay small compared to the airtime
+		step <<= 1;
+		if (step > DLUSB_ACK_POLL_MAX_MS)
+			step = DLUSB_ACK_POLL_MAX_MS;
+	}
+
+#ifdef DEBUG
+	// Print out the returned buffer.
+	printf("Read Feature Report from DigiLivolo: ");
+	for (uint32_t i = 0; i < res; i++)
+		printf("%02x ", *(((uint8_t*)packet) + i));
+	printf("\n");
+#endif // DEBUG
+
+	return res;
+}
+
+bool dlusb_is_reply(const dlusb_packet_t* packet, uint8_t seq) {
+	if (packet->seq != 0)
+		return packet->seq == seq;
+
+	// Untagged reply from the older firmware, anything except RDY packet is a reply to the last command
+	return packet->cmd_id != CMD_RDY;
+}
+
+bool dlusb_is_ack(const dlusb_packet_t* packet, uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t seq) {
+	return (dlusb_is_reply(packet, seq) && packet->status == DL_STATUS_OK && \
+		packet->cmd_id == (use_old_alg ? CMD_SWITCH_OLD : CMD_SWITCH) && \
+		packet->remote_id == remote_id && packet->btn_id == btn_id);
+}
+
+bool dlusb_is_multi_ack(const dlusb_packet_t* packet, uint8_t seq) {
+	return (packet->seq == seq && packet->status == DL_STATUS_OK && packet->cmd_id == CMD_SWITCH_MULTI);
+}
+
+error_t dlusb_wait_reply(dlusb_packet_t* packet, uint8_t seq, dl_device_t* handle, uint32_t timeout_ms, bool verbose) {
+	uint64_t deadline = dl_time_us() + timeout_ms * 1000ULL;
+	int res;
+
+	// Skip stale reports until a reply to our command arrives
+	do {
+		uint64_t now = dl_time_us();
+		res = (now < deadline) ? dlusb_wait_packet(packet, handle, (uint32_t)((deadline - now) / 1000)) : DLUSB_ERR_TIMEOUT;
+		if (res == DLUSB_ERR_TIMEOUT) {
+			if (verbose)
+				printf("WARN: No reply from device after %u ms: %ls\n", timeout_ms, dl_error(handle));
+			return DLUSB_ERR_TIMEOUT;
+		}
+		else if (verbose && !dlusb_is_reply(packet, seq))
+			printf("Skipping stale report from device (CMD ID 0x%02x, seq %u).\n", packet->cmd_id, packet->seq);
+	} while (!dlusb_is_reply(packet, seq));
+
+	return DLUSB_OK;
+}
+
+error_t dlusb_wait_ack(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t seq, dl_device_t* handle, bool verbose, uint32_t* latency_us) {
+	dlusb_packet_t packet;
+	uint64_t start = dl_time_us();
+
+	if (dlusb_wait_reply(&packet, seq, handle, DLUSB_ACK_TIMEOUT_MS, verbose) != DLUSB_OK)
+		return DLUSB_ERR_TIMEOUT;
+
+	if (latency_us)
+		*latency_us = (uint32_t)(dl_time_us() - start);
+
+	if (verbose)
+		printf("ACK received in %.1f ms.\n", (dl_time_us() - start) / 1000.0);
+
+	if (dlusb_is_ack(&packet, remote_id, btn_id, use_old_alg, seq))
+		return DLUSB_OK;
+	else if (packet.seq != 0 && packet.status != DL_STATUS_OK)
+		return DLUSB_ERR_STATUS;
+	else
+		return DLUSB_ERR_REPLY;
+}
+
+error_t dlusb_switch(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t repeats, dl_device_t* handle, bool verbose, uint32_t* latency_us) {
+	uint64_t start = dl_time_us();
+	error_t res;
+
+	uint8_t seq = dlusb_next_seq();
+
+	if (dlusb_send(remote_id, btn_id, use_old_alg, repeats, seq, handle) < 0)
+		return DLUSB_ERR_SEND;
+
+	if (verbose)
+		printf("Command sent to device. Waiting for a reply...\n");
+
+	res = dlusb_wait_ack(remote_id, btn_id, use_old_alg, seq, handle, verbose, NULL);
+	if (latency_us)
+		*latency_us = (uint32_t)(dl_time_us() - start);
+
+	return res;
+}
+
+const char* dlusb_strerror(error_t err) {
+	switch (err) {
+	case DLUSB_OK:
+		return "OK";
+	case DLUSB_ERR_SEND:
+		return "unable to send command to device";
+	case DLUSB_ERR_REPLY:
+		return "wrong reply from device";
+	case DLUSB_ERR_TIMEOUT:
+		return "no reply from device";
+	case DLUSB_ERR_STATUS:
+		return "device reported an error";
+	default:
+		return "unknown error";
+	}
+}
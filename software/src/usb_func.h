@@ -21,11 +21,31 @@
 #ifndef __usb_func_h__
 #define __usb_func_h__
 
+#include "transport.h"
+
 #ifndef __error_t_defined
 typedef int error_t;
 #define __error_t_defined
 #endif
 
+// Error codes returned by dlusb_switch() & dlusb_wait_ack()
+#define DLUSB_OK 0
+#define DLUSB_ERR_SEND -1 // Unable to send a command to the device
+#define DLUSB_ERR_REPLY -2 // Device replied with a wrong ACK
+#define DLUSB_ERR_TIMEOUT -3 // No ACK from the device before the deadline
+#define DLUSB_ERR_STATUS -4 // Device replied with an error status
+
+/* Approximate time device needs to air one command: 129 frames of ~8 ms each
+ * with the timer method, a bit more with the old algorithm. */
+#define DLUSB_TX_DURATION_MS 1100
+// Give up waiting for the ACK after this time
+#define DLUSB_ACK_TIMEOUT_MS (3 * DLUSB_TX_DURATION_MS)
+// Feature report poll interval (older firmware) starts from DLUSB_ACK_POLL_MIN_MS & doubles up to DLUSB_ACK_POLL_MAX_MS
+#define DLUSB_ACK_POLL_MIN_MS 5
+#define DLUSB_ACK_POLL_MAX_MS 40
+// How long to wait for CMD_TIMES report after the ACK, device queues it right after the ACK
+#define DLUSB_TIMES_TIMEOUT_MS 200
+
 extern const char* hid_bus_name(hid_bus_type bus_type);
 
 /// @brief Prints brief info on one device supplied by the cur_dev.
@@ -48,19 +68,244 @@ extern void print_devices(struct hid_device_info* cur_dev);
 /// @return Pointer to matched device or NULL if no matches were found.
 extern struct hid_device_info* find_digilivolo(struct hid_device_info* cur_dev);
 
+/// @brief Returns next command sequence number, never 0.
+/// @return sequence number to tag a command with
+extern uint8_t dlusb_next_seq(void);
+
 /// @brief Sends Livolo remote key press event
 /// @param remote_id[in] Livolo Remote ID to send
 /// @param btn_id[in] Livolo Keycode to send
+/// @param use_old_alg[in] use CMD_SWITCH_OLD transmit method
+/// @param repeats[in] frame repeats after the first one, 0 - device default. Ignored with CMD_SWITCH_OLD
+///        and by firmware older than DL_FW_VERSION_REPEATS.
+/// @param seq[in] command sequence number, echoed back by the device in ACK
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Passes return code from dl_send_feature_report()
+/// @see dl_send_feature_report, dlusb_next_seq
+extern error_t dlusb_send(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t repeats, uint8_t seq, dl_device_t* handle);
+
+/// @brief Checks if the device takes frame repeats from the commands.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_REPEATS or newer
+/// @see dlusb_send
+extern bool dlusb_has_repeats(const dl_device_t* handle);
+
+/// @brief Checks if the device accepts several commands in one report.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_MULTI or newer
+/// @see dlusb_send_multi
+extern bool dlusb_has_multi(const dl_device_t* handle);
+
+/// @brief Sends several Livolo remote key press events in one REPORT_ID_MULTI report.
+///        Device queues all of them or none, and sends one CMD_SWITCH_MULTI ACK
+///        tagged with seq after the last one has been transmitted.
+/// @param tuples[in] commands to send
+/// @param count[in] number of commands, 1 to DL_MULTI_MAX
+/// @param repeats[in] frame repeats for all the commands, as in dlusb_send()
+/// @param seq[in] sequence number, echoed back by the device in ACK
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Passes return code from dl_send_feature_report(), -1 if count is out of range
+/// @see dl_send_feature_report, dlusb_is_multi_ack
+extern error_t dlusb_send_multi(const dl_tuple_t* tuples, uint8_t count, uint8_t repeats, uint8_t seq, dl_device_t* handle);
+
+/// @brief Checks if the device returns status report.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_STATUS or newer
+/// @see dlusb_get_status
+extern bool dlusb_has_status(const dl_device_t* handle);
+
+/// @brief Reads device queues & transmitter state (REPORT_ID_STATUS Feature Report).
+///        Doesn't consume replies pending in the device queue.
+/// @param status[out] pointer to a dlusb_status_packet_t
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Report size on success, negative value on error or malformed report
+/// @see dl_get_feature_report
+extern error_t dlusb_get_status(dlusb_status_packet_t* status, dl_device_t* handle);
+
+/// @brief Checks if the device returns stats report.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_STATS or newer
+/// @see dlusb_get_stats
+extern bool dlusb_has_stats(const dl_device_t* handle);
+
+/// @brief Reads device counters (REPORT_ID_STATS Feature Report). Counters run since the device
+///        power up & wrap around.
+/// @param stats[out] pointer to a dlusb_stats_packet_t
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Report size on success, negative value on error or malformed report
+/// @see dl_get_feature_report
+extern error_t dlusb_get_stats(dlusb_stats_packet_t* stats, dl_device_t* handle);
+
+/// @brief Checks if the device reports timings of the commands.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_TIMES or newer
+/// @see dlusb_request_times, dlusb_wait_times
+extern bool dlusb_has_times(const dl_device_t* handle);
+
+/// @brief Asks the device to send CMD_TIMES report after the ACK of every switch command
+///        sent with dlusb_send() from now on (DL_FLAG_TIMES). Not applied to dlusb_send_multi().
+/// @param handle[in] pointer to DigiLivolo device
+/// @param enable[in] request timings or stop requesting them
+/// @return false if enable is set, but the opened device doesn't report timings
+extern bool dlusb_request_times(dl_device_t* handle, bool enable);
+
+/// @brief Checks if the switch commands are sent with DL_FLAG_TIMES.
+/// @param handle[in] pointer to DigiLivolo device
+/// @see dlusb_request_times
+extern bool dlusb_times_requested(const dl_device_t* handle);
+
+/// @brief Waits for CMD_TIMES report of the command after its ACK has been received.
+/// @param times[out] pointer to a dlusb_times_packet_t
+/// @param seq[in] command sequence number
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @return DLUSB_OK on success, DLUSB_ERR_TIMEOUT if it doesn't arrive in DLUSB_TIMES_TIMEOUT_MS
+///         or DLUSB_ERR_REPLY if some other reply to the command arrived
+/// @see dlusb_wait_reply
+extern error_t dlusb_wait_times(dlusb_times_packet_t* times, uint8_t seq, dl_device_t* handle, bool verbose);
+
+/// @brief Checks if the device stores & plays scenes.
 /// @param handle[in] pointer to DigiLivolo device
-/// @return Passes return code from hid_send_feature_report()
-/// @see hid_send_feature_report
-extern error_t dlusb_send(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, hid_device* handle);
+/// @return true if firmware is DL_FW_VERSION_SCENE or newer
+/// @see dlusb_send_scene, dlusb_send_data
+extern bool dlusb_has_scenes(const dl_device_t* handle);
+
+/// @brief Asks the device to play a scene from its EEPROM (CMD_SCENE). Device sends
+///        one ACK tagged with seq after the last button code of the scene has been sent.
+/// @param scene_id[in] scene ID
+/// @param seq[in] command sequence number, echoed back by the device in ACK
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Passes return code from dl_send_feature_report()
+/// @see dl_send_feature_report
+extern error_t dlusb_send_scene(uint8_t scene_id, uint8_t seq, dl_device_t* handle);
+
+/// @brief Sends a DL_DATA_SIZE bytes block in REPORT_ID_DATA report. Device ACKs it
+///        with cmd_id, seq & offset (in remote_id field) once the block is processed.
+/// @param cmd_id[in] command to process the block with, i.e. CMD_SCENE_WRITE
+/// @param offset[in] offset of the block
+/// @param data[in] DL_DATA_SIZE bytes of data
+/// @param seq[in] sequence number, echoed back by the device in ACK
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Passes return code from dl_send_feature_report()
+/// @see dl_send_feature_report
+extern error_t dlusb_send_data(uint8_t cmd_id, uint16_t offset, const uint8_t* data, uint8_t seq, dl_device_t* handle);
+
+/// @brief Checks if the device has RF timing profile.
+/// @param handle[in] pointer to DigiLivolo device
+/// @return true if firmware is DL_FW_VERSION_TIMING or newer
+/// @see dlusb_get_timing, dlusb_set_timing
+extern bool dlusb_has_timing(const dl_device_t* handle);
+
+/// @brief Reads RF timing profile in effect (REPORT_ID_DATA Feature Report with CMD_TIMING).
+/// @param timing[out] pointer to a dl_timing_t
+/// @param handle[in] pointer to DigiLivolo device
+/// @return Report size on success, negative value on error or malformed report
+/// @see dl_get_feature_report
+extern error_t dlusb_get_timing(dl_timing_t* timing, dl_device_t* handle);
+
+/// @brief Sets RF timing profile & waits until the device stores it in EEPROM.
+/// @param timing[in] profile, repeats == 0 restores the defaults
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @return DLUSB_OK on success or DLUSB_ERR_* code, DLUSB_ERR_STATUS if a value is out of range
+/// @see dlusb_send_data
+extern error_t dlusb_set_timing(const dl_timing_t* timing, dl_device_t* handle, bool verbose);
 
 /// @brief Read a Feature Report from the device
 /// @param packet[out] pointer to a dlusb_packet_t
 /// @param handle[in] pointer to DigiLivolo device
-/// @return Passes return code from hid_get_feature_report()
-/// @see hid_get_feature_report
-extern error_t dlusb_read(dlusb_packet_t* packet, hid_device* handle);
+/// @return Passes return code from dl_get_feature_report()
+/// @see dl_get_feature_report
+extern error_t dlusb_read(dlusb_packet_t* packet, dl_device_t* handle);
+
+/// @brief Opens DigiLivolo device via the transport, by default the first one found with hidapi.
+///        For firmware older than DL_FW_VERSION_SEQ also drains any stale reports (RDY packet,
+///        ACKs left from previous runs) from it. Firmware DL_FW_VERSION_INTR and newer
+///        are asked to send replies via interrupt IN reports.
+/// @param transport[in] "NAME[:ARGS]" transport spec or NULL for the default one
+/// @param verbose[in] print diagnostic messages & device lists on failure
+/// @return Pointer to the opened device or NULL on failure, closed with dl_close()
+/// @see dl_transport_open
+extern dl_device_t* dlusb_open(const char* transport, bool verbose);
+
+/// @brief Reads & discards all pending Feature Reports from the device.
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+extern void dlusb_drain(dl_device_t* handle, bool verbose);
+
+/// @brief Waits for a report from the device until one arrives or timeout passes.
+///        With firmware supporting DL_FLAG_INTR blocks on the interrupt IN report,
+///        otherwise polls Feature Report with an exponential backoff.
+/// @param packet[out] pointer to a dlusb_packet_t
+/// @param handle[in] pointer to DigiLivolo device
+/// @param timeout_ms[in] how long to wait for the report
+/// @return Report size (> 0) on success or DLUSB_ERR_TIMEOUT
+extern error_t dlusb_wait_packet(dlusb_packet_t* packet, dl_device_t* handle, uint32_t timeout_ms);
+
+/// @brief Checks if a packet received from the device is a reply to the command
+///        tagged with seq. Untagged replies from firmware older than DL_FW_VERSION_SEQ
+///        are considered replies to any command, except for the RDY packet.
+/// @param packet[in] packet received from the device
+/// @param seq[in] command sequence number
+/// @return true if packet is a reply to the command
+extern bool dlusb_is_reply(const dlusb_packet_t* packet, uint8_t seq);
+
+/// @brief Checks if a packet received from the device is a successful ACK for the command.
+/// @param packet[in] packet received from the device
+/// @param remote_id[in] Livolo Remote ID which was sent
+/// @param btn_id[in] Livolo Keycode which was sent
+/// @param use_old_alg[in] command was sent with CMD_SWITCH_OLD
+/// @param seq[in] command sequence number
+/// @return true if packet matches the command
+extern bool dlusb_is_ack(const dlusb_packet_t* packet, uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t seq);
+
+/// @brief Checks if a packet received from the device is a successful ACK for the
+///        commands sent with dlusb_send_multi().
+/// @param packet[in] packet received from the device
+/// @param seq[in] sequence number the report was sent with
+/// @return true if packet is an ACK for the report
+extern bool dlusb_is_multi_ack(const dlusb_packet_t* packet, uint8_t seq);
+
+/// @brief Waits for a reply to the command tagged with seq until it arrives or timeout passes.
+///        Stale reports which aren't replies to the command are skipped.
+/// @param packet[out] pointer to a dlusb_packet_t for the reply
+/// @param seq[in] command sequence number
+/// @param handle[in] pointer to DigiLivolo device
+/// @param timeout_ms[in] how long to wait for the reply
+/// @param verbose[in] print diagnostic messages
+/// @return DLUSB_OK if reply arrived or DLUSB_ERR_TIMEOUT
+/// @see dlusb_wait_packet, dlusb_is_reply
+extern error_t dlusb_wait_reply(dlusb_packet_t* packet, uint8_t seq, dl_device_t* handle, uint32_t timeout_ms, bool verbose);
+
+/// @brief Waits for the device to ACK previously sent command until ACK arrives
+///        or DLUSB_ACK_TIMEOUT_MS passes.
+///        Stale reports which aren't replies to the command are skipped.
+/// @see dlusb_wait_packet
+/// @param remote_id[in] Livolo Remote ID which was sent
+/// @param btn_id[in] Livolo Keycode which was sent
+/// @param use_old_alg[in] command was sent with CMD_SWITCH_OLD
+/// @param seq[in] command sequence number
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @param latency_us[out](optional) time spent waiting for the ACK, in microseconds
+/// @return DLUSB_OK on success or DLUSB_ERR_* code
+extern error_t dlusb_wait_ack(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t seq, dl_device_t* handle, bool verbose, uint32_t* latency_us);
+
+/// @brief Sends Livolo remote key press event and waits for the device ACK.
+/// @param remote_id[in] Livolo Remote ID to send
+/// @param btn_id[in] Livolo Keycode to send
+/// @param use_old_alg[in] use CMD_SWITCH_OLD transmit method
+/// @param repeats[in] frame repeats after the first one, 0 - device default
+/// @param handle[in] pointer to DigiLivolo device
+/// @param verbose[in] print diagnostic messages
+/// @param latency_us[out](optional) time from sending the command to the ACK, in microseconds
+/// @return DLUSB_OK on success or DLUSB_ERR_* code
+/// @see dlusb_send, dlusb_wait_ack
+extern error_t dlusb_switch(uint16_t remote_id, uint8_t btn_id, bool use_old_alg, uint8_t repeats, dl_device_t* handle, bool verbose, uint32_t* latency_us);
+
+/// @brief Returns text description of DLUSB_* code.
+/// @param err[in] DLUSB_OK or DLUSB_ERR_* code
+/// @return pointer to a static string
+extern const char* dlusb_strerror(error_t err);
 
 #endif // __usb_func_h__